@@ -1,24 +1,89 @@
+set(ADD_RESOURCES_MODULE_DIR "${CMAKE_CURRENT_LIST_DIR}")
+
 find_program(XXD_COMMAND NAMES xxd)
+find_program(GZIP_COMMAND NAMES gzip)
+find_program(BROTLI_COMMAND NAMES brotli)
+
+function(_resource_mime_type EXTENSION OUT_VAR)
+    string(TOLOWER "${EXTENSION}" EXTENSION)
+
+    if(EXTENSION MATCHES "^\\.(htm|html|php)$")
+        set(MIME_TYPE "text/html")
+    elseif(EXTENSION STREQUAL ".css")
+        set(MIME_TYPE "text/css")
+    elseif(EXTENSION STREQUAL ".txt")
+        set(MIME_TYPE "text/plain")
+    elseif(EXTENSION MATCHES "^\\.(js|mjs)$")
+        set(MIME_TYPE "application/javascript")
+    elseif(EXTENSION STREQUAL ".json")
+        set(MIME_TYPE "application/json")
+    elseif(EXTENSION STREQUAL ".xml")
+        set(MIME_TYPE "application/xml")
+    elseif(EXTENSION STREQUAL ".bmp")
+        set(MIME_TYPE "image/bmp")
+    elseif(EXTENSION STREQUAL ".png")
+        set(MIME_TYPE "image/png")
+    elseif(EXTENSION MATCHES "^\\.(jpe|jpeg|jpg)$")
+        set(MIME_TYPE "image/jpeg")
+    elseif(EXTENSION STREQUAL ".gif")
+        set(MIME_TYPE "image/gif")
+    elseif(EXTENSION STREQUAL ".ico")
+        set(MIME_TYPE "image/vnd.microsoft.icon")
+    elseif(EXTENSION MATCHES "^\\.(tif|tiff)$")
+        set(MIME_TYPE "image/tiff")
+    elseif(EXTENSION MATCHES "^\\.(svg|svgz)$")
+        set(MIME_TYPE "image/svg+xml")
+    elseif(EXTENSION STREQUAL ".ttf")
+        set(MIME_TYPE "font/ttf")
+    elseif(EXTENSION STREQUAL ".woff")
+        set(MIME_TYPE "font/woff")
+    elseif(EXTENSION STREQUAL ".woff2")
+        set(MIME_TYPE "font/woff2")
+    else()
+        set(MIME_TYPE "application/octet-stream")
+    endif()
+
+    set(${OUT_VAR} "${MIME_TYPE}" PARENT_SCOPE)
+endfunction()
 
 # Usage:
 #  add_resources(
 #    name                       # Name of created target
-#    GENERATE_MAP               # Generate map header (optional)
+#    GENERATE_MAP               # Generate lookup header (optional)
 #    NAMESPACE <namespace>      # Namespace of created symbols (optional)
 #    HEADER_PATH <dir>          # Include path of generated headers (optional)
+#    STRIP_PREFIX <prefix>      # Prefix removed from file paths to form lookup keys (optional)
+#    CACHE_CONTROL <value>      # Cache-Control sent with every resource (optional)
+#    COMPRESS_EXTENSIONS <exts> # Also embed gzip (and brotli, if available) variants of files with these extensions (optional)
 #    FILES <files [...]>        # Files to include
 #  )
+#
+# Compressed variants are produced at configure time and are named <symbol>_gz and <symbol>_br.
+# A variant is only embedded if it is smaller than the original.
+#
+# With GENERATE_MAP, <name>_lookup(key) finds resources by path through a perfect hash table built at
+# compile time, and every variant is given a strong ETag derived from the SHA-256 of the source file.
+# Each variant also carries its response header fields (Content-Type, Content-Length, ETag, ...)
+# serialized at build time, so serving it needs no header formatting.
 function(add_resources NAME)
 
     set(OPTIONS GENERATE_MAP)
-    set(ONE_VALUE_ARGS NAMESPACE HEADER_PATH)
-    set(MULTI_VALUE_ARGS FILES)
+    set(ONE_VALUE_ARGS NAMESPACE HEADER_PATH STRIP_PREFIX CACHE_CONTROL)
+    set(MULTI_VALUE_ARGS COMPRESS_EXTENSIONS FILES)
     cmake_parse_arguments(ARGS "${OPTIONS}" "${ONE_VALUE_ARGS}" "${MULTI_VALUE_ARGS}" ${ARGN})
 
     if(NOT XXD_COMMAND)
         message(FATAL_ERROR "xxd not found")
     endif()
 
+    if(DEFINED ARGS_COMPRESS_EXTENSIONS AND NOT GZIP_COMMAND)
+        message(FATAL_ERROR "gzip not found")
+    endif()
+
+    if(DEFINED ARGS_COMPRESS_EXTENSIONS AND NOT BROTLI_COMMAND)
+        message(STATUS "brotli not found: static resources will not have brotli variants")
+    endif()
+
     if(NOT DEFINED ARGS_HEADER_PATH)
         set(ARGS_HEADER_PATH ".")
     endif()
@@ -31,14 +96,60 @@ function(add_resources NAME)
 
     foreach(IN_FILE IN LISTS ARGS_FILES)
         get_filename_component(IN_FILE_BASE_NAME ${IN_FILE} NAME)
+        get_filename_component(IN_FILE_EXTENSION ${IN_FILE} LAST_EXT)
         string(REGEX REPLACE "[^a-zA-Z0-9]" "_" SYMBOL_NAME "${IN_FILE_BASE_NAME}")
 
         set(FULL_IN_FILE_PATH "${CMAKE_CURRENT_LIST_DIR}/${IN_FILE}")
         file(SIZE "${FULL_IN_FILE_PATH}" IN_FILE_SIZE)
+        file(SHA256 "${FULL_IN_FILE_PATH}" IN_FILE_HASH)
+        string(SUBSTRING "${IN_FILE_HASH}" 0 32 RESOURCE_${SYMBOL_NAME}_HASH)
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${FULL_IN_FILE_PATH}")
 
         set(OUT_HEADER_FILE "${OUT_FILE_PATH}/${SYMBOL_NAME}.hpp")
         set(OUT_SOURCE_FILE "${OUT_FILE_PATH}/${SYMBOL_NAME}.cpp")
-        set(OUT_HEXINC_FILE "${OUT_FILE_PATH}/${SYMBOL_NAME}.inc")
+
+        # Compress
+
+        set(VARIANT_SYMBOLS "${SYMBOL_NAME}")
+        set(${SYMBOL_NAME}_FILE "${FULL_IN_FILE_PATH}")
+        set(${SYMBOL_NAME}_SIZE "${IN_FILE_SIZE}")
+
+        if(IN_FILE_EXTENSION IN_LIST ARGS_COMPRESS_EXTENSIONS)
+            set(COMPRESSORS "gz")
+            if(BROTLI_COMMAND)
+                list(APPEND COMPRESSORS "br")
+            endif()
+
+            foreach(COMPRESSOR IN LISTS COMPRESSORS)
+                set(COMPRESSED_FILE "${OUT_FILE_PATH}/${SYMBOL_NAME}.${COMPRESSOR}")
+
+                if(NOT EXISTS "${COMPRESSED_FILE}" OR "${FULL_IN_FILE_PATH}" IS_NEWER_THAN "${COMPRESSED_FILE}")
+                    if(COMPRESSOR STREQUAL "gz")
+                        set(COMPRESS_COMMAND "${GZIP_COMMAND}" -9 -n -c "${FULL_IN_FILE_PATH}")
+                    else()
+                        set(COMPRESS_COMMAND "${BROTLI_COMMAND}" -q 11 -c "${FULL_IN_FILE_PATH}")
+                    endif()
+
+                    file(MAKE_DIRECTORY "${OUT_FILE_PATH}")
+                    execute_process(
+                        COMMAND ${COMPRESS_COMMAND}
+                        OUTPUT_FILE "${COMPRESSED_FILE}"
+                        RESULT_VARIABLE COMPRESS_RESULT
+                    )
+                    if(NOT COMPRESS_RESULT EQUAL 0)
+                        message(FATAL_ERROR "Failed to compress ${IN_FILE}")
+                    endif()
+                endif()
+
+                file(SIZE "${COMPRESSED_FILE}" COMPRESSED_FILE_SIZE)
+                if(COMPRESSED_FILE_SIZE LESS IN_FILE_SIZE)
+                    list(APPEND VARIANT_SYMBOLS "${SYMBOL_NAME}_${COMPRESSOR}")
+                    set(${SYMBOL_NAME}_${COMPRESSOR}_FILE "${COMPRESSED_FILE}")
+                    set(${SYMBOL_NAME}_${COMPRESSOR}_SIZE "${COMPRESSED_FILE_SIZE}")
+                    set(RESOURCE_${SYMBOL_NAME}_${COMPRESSOR} TRUE)
+                endif()
+            endforeach()
+        endif()
 
         # Write header
 
@@ -60,11 +171,13 @@ function(add_resources NAME)
             )
         endif()
 
-        file(
-            APPEND "${OUT_HEADER_FILE}"
+        foreach(VARIANT_SYMBOL IN LISTS VARIANT_SYMBOLS)
+            file(
+                APPEND "${OUT_HEADER_FILE}"
 
-            "extern const std::array<unsigned char, ${IN_FILE_SIZE}> ${SYMBOL_NAME};\n"
-        )
+                "extern const std::array<unsigned char, ${${VARIANT_SYMBOL}_SIZE}> ${VARIANT_SYMBOL};\n"
+            )
+        endforeach()
 
         if(DEFINED ARGS_NAMESPACE)
             file(
@@ -97,13 +210,15 @@ function(add_resources NAME)
             )
         endif()
 
-        file(
-            APPEND "${OUT_SOURCE_FILE}"
+        foreach(VARIANT_SYMBOL IN LISTS VARIANT_SYMBOLS)
+            file(
+                APPEND "${OUT_SOURCE_FILE}"
 
-            "const std::array<unsigned char, ${IN_FILE_SIZE}> ${SYMBOL_NAME} {\n"
-            "#include \"${ARGS_HEADER_PATH}/${SYMBOL_NAME}.inc\"\n"
-            "};\n"
-        )
+                "const std::array<unsigned char, ${${VARIANT_SYMBOL}_SIZE}> ${VARIANT_SYMBOL} {\n"
+                "#include \"${ARGS_HEADER_PATH}/${VARIANT_SYMBOL}.inc\"\n"
+                "};\n"
+            )
+        endforeach()
 
         if(DEFINED ARGS_NAMESPACE)
             file(
@@ -116,15 +231,19 @@ function(add_resources NAME)
 
         list(APPEND OUT_SOURCE_FILE_LIST "${OUT_SOURCE_FILE}")
 
-        # Write hex dump
+        # Write hex dumps
 
-        add_custom_command(
-            OUTPUT "${OUT_HEXINC_FILE}"
-            COMMAND "${XXD_COMMAND}" -i < "${FULL_IN_FILE_PATH}" > "${OUT_HEXINC_FILE}"
-            DEPENDS "${FULL_IN_FILE_PATH}"
-        )
+        foreach(VARIANT_SYMBOL IN LISTS VARIANT_SYMBOLS)
+            set(OUT_HEXINC_FILE "${OUT_FILE_PATH}/${VARIANT_SYMBOL}.inc")
 
-        list(APPEND OUT_HEXINC_FILE_LIST "${OUT_HEXINC_FILE}")
+            add_custom_command(
+                OUTPUT "${OUT_HEXINC_FILE}"
+                COMMAND "${XXD_COMMAND}" -i < "${${VARIANT_SYMBOL}_FILE}" > "${OUT_HEXINC_FILE}"
+                DEPENDS "${${VARIANT_SYMBOL}_FILE}"
+            )
+
+            list(APPEND OUT_HEXINC_FILE_LIST "${OUT_HEXINC_FILE}")
+        endforeach()
 
     endforeach()
 
@@ -139,27 +258,8 @@ function(add_resources NAME)
 
             "#pragma once\n"
             "\n"
-            "#include <functional>\n"
-            "#include <map>\n"
             "#include <span>\n"
-            "#include <string>\n"
-            "\n"
-        )
-
-        foreach(IN_FILE IN LISTS ARGS_FILES)
-            get_filename_component(IN_FILE_BASE_NAME ${IN_FILE} NAME)
-            string(REGEX REPLACE "\\.|-" "_" SYMBOL_NAME "${IN_FILE_BASE_NAME}")
-
-            file(
-                APPEND "${OUT_HEADER_FILE}"
-
-                "#include \"${ARGS_HEADER_PATH}/${SYMBOL_NAME}.hpp\"\n"
-            )
-        endforeach()
-
-        file(
-            APPEND "${OUT_HEADER_FILE}"
-
+            "#include <string_view>\n"
             "\n"
         )
 
@@ -175,7 +275,24 @@ function(add_resources NAME)
         file(
             APPEND "${OUT_HEADER_FILE}"
 
-            "extern const std::map<std::string, std::span<const unsigned char>, std::less<>> ${NAME}_map;\n"
+            "struct Variant {\n"
+            "    std::span<const unsigned char> data;\n"
+            "    std::string_view etag;\n"
+            "    // Serialized header fields for a 200 response carrying data, each terminated by CRLF.\n"
+            "    std::string_view headers;\n"
+            "    // Serialized header fields for a 304 response, each terminated by CRLF.\n"
+            "    std::string_view not_modified_headers;\n"
+            "};\n"
+            "\n"
+            "// Compressed variants are empty if they were not generated for a resource.\n"
+            "struct Resource {\n"
+            "    Variant identity;\n"
+            "    Variant gzip;\n"
+            "    Variant brotli;\n"
+            "};\n"
+            "\n"
+            "// Returns nullptr if there is no resource for key.\n"
+            "const Resource* ${NAME}_lookup(std::string_view key) noexcept;\n"
         )
 
         if(DEFINED ARGS_NAMESPACE)
@@ -196,37 +313,129 @@ function(add_resources NAME)
 
             "#include \"${ARGS_HEADER_PATH}/${NAME}.hpp\"\n"
             "\n"
+            "#include <algorithm>\n"
+            "#include <array>\n"
+            "#include <bit>\n"
+            "#include <cstddef>\n"
+            "#include <cstdint>\n"
+            "\n"
         )
 
-        if(DEFINED ARGS_NAMESPACE)
+        foreach(IN_FILE IN LISTS ARGS_FILES)
+            get_filename_component(IN_FILE_BASE_NAME ${IN_FILE} NAME)
+            string(REGEX REPLACE "[^a-zA-Z0-9]" "_" SYMBOL_NAME "${IN_FILE_BASE_NAME}")
+
             file(
                 APPEND "${OUT_SOURCE_FILE}"
 
-                "namespace ${ARGS_NAMESPACE} {\n"
-                "\n"
+                "#include \"${ARGS_HEADER_PATH}/${SYMBOL_NAME}.hpp\"\n"
             )
-        endif()
+        endforeach()
 
         file(
             APPEND "${OUT_SOURCE_FILE}"
 
-            "const std::map<std::string, std::span<const unsigned char>, std::less<>> ${NAME}_map = {\n"
+            "\n"
         )
 
-        foreach(IN_FILE IN LISTS ARGS_FILES)
-            get_filename_component(IN_FILE_BASE_NAME ${IN_FILE} NAME)
-            string(REGEX REPLACE "[^a-zA-Z0-9]" "_" SYMBOL_NAME "${IN_FILE_BASE_NAME}")
+        if(DEFINED ARGS_NAMESPACE)
             file(
                 APPEND "${OUT_SOURCE_FILE}"
 
-                "    {\"${IN_FILE}\", {${SYMBOL_NAME}.data(), ${SYMBOL_NAME}.size()}},\n"
+                "namespace ${ARGS_NAMESPACE} {\n"
+                "\n"
             )
+        endif()
+
+        list(LENGTH ARGS_FILES RESOURCE_COUNT)
+        set(KEYS_INITIALIZER "")
+        set(RESOURCES_INITIALIZER "")
+
+        foreach(IN_FILE IN LISTS ARGS_FILES)
+            get_filename_component(IN_FILE_BASE_NAME ${IN_FILE} NAME)
+            string(REGEX REPLACE "[^a-zA-Z0-9]" "_" SYMBOL_NAME "${IN_FILE_BASE_NAME}")
+
+            set(RESOURCE_KEY "${IN_FILE}")
+            if(DEFINED ARGS_STRIP_PREFIX)
+                string(FIND "${IN_FILE}" "${ARGS_STRIP_PREFIX}" PREFIX_POSITION)
+                if(PREFIX_POSITION EQUAL 0)
+                    string(LENGTH "${ARGS_STRIP_PREFIX}" PREFIX_LENGTH)
+                    string(SUBSTRING "${IN_FILE}" ${PREFIX_LENGTH} -1 RESOURCE_KEY)
+                endif()
+            endif()
+
+            get_filename_component(IN_FILE_EXTENSION ${IN_FILE} LAST_EXT)
+            _resource_mime_type("${IN_FILE_EXTENSION}" RESOURCE_CONTENT_TYPE)
+
+            set(RESOURCE_HASH "${RESOURCE_${SYMBOL_NAME}_HASH}")
+            set(RESOURCE_HAS_VARIANTS FALSE)
+            if(RESOURCE_${SYMBOL_NAME}_gz OR RESOURCE_${SYMBOL_NAME}_br)
+                set(RESOURCE_HAS_VARIANTS TRUE)
+            endif()
+
+            set(RESOURCE_INITIALIZER "")
+            foreach(COMPRESSOR IN ITEMS identity gz br)
+                if(COMPRESSOR STREQUAL "identity")
+                    set(VARIANT_SYMBOL "${SYMBOL_NAME}")
+                    set(VARIANT_ETAG "\\\"${RESOURCE_HASH}\\\"")
+                elseif(RESOURCE_${SYMBOL_NAME}_${COMPRESSOR})
+                    set(VARIANT_SYMBOL "${SYMBOL_NAME}_${COMPRESSOR}")
+                    set(VARIANT_ETAG "\\\"${RESOURCE_HASH}-${COMPRESSOR}\\\"")
+                else()
+                    string(APPEND RESOURCE_INITIALIZER ", {}")
+                    continue()
+                endif()
+
+                # Headers common to 200 and 304 responses, then those only sent with a body
+
+                set(VARIANT_NOT_MODIFIED_HEADERS "ETag: ${VARIANT_ETAG}\\r\\n")
+                if(DEFINED ARGS_CACHE_CONTROL)
+                    string(APPEND VARIANT_NOT_MODIFIED_HEADERS "Cache-Control: ${ARGS_CACHE_CONTROL}\\r\\n")
+                endif()
+                if(RESOURCE_HAS_VARIANTS)
+                    string(APPEND VARIANT_NOT_MODIFIED_HEADERS "Vary: Accept-Encoding\\r\\n")
+                endif()
+
+                set(VARIANT_HEADERS "Content-Type: ${RESOURCE_CONTENT_TYPE}\\r\\nContent-Length: ${${VARIANT_SYMBOL}_SIZE}\\r\\n")
+                if(COMPRESSOR STREQUAL "gz")
+                    string(APPEND VARIANT_HEADERS "Content-Encoding: gzip\\r\\n")
+                elseif(COMPRESSOR STREQUAL "br")
+                    string(APPEND VARIANT_HEADERS "Content-Encoding: br\\r\\n")
+                endif()
+                string(APPEND VARIANT_HEADERS "${VARIANT_NOT_MODIFIED_HEADERS}")
+
+                string(APPEND RESOURCE_INITIALIZER ", {{${VARIANT_SYMBOL}.data(), ${VARIANT_SYMBOL}.size()}, \"${VARIANT_ETAG}\", \"${VARIANT_HEADERS}\", \"${VARIANT_NOT_MODIFIED_HEADERS}\"}")
+            endforeach()
+            string(SUBSTRING "${RESOURCE_INITIALIZER}" 2 -1 RESOURCE_INITIALIZER)
+
+            string(APPEND KEYS_INITIALIZER "    \"${RESOURCE_KEY}\",\n")
+            string(APPEND RESOURCES_INITIALIZER "    Resource{${RESOURCE_INITIALIZER}},\n")
         endforeach()
 
         file(
             APPEND "${OUT_SOURCE_FILE}"
 
+            "namespace {\n"
+            "\n"
+            "constexpr std::array<std::string_view, ${RESOURCE_COUNT}> keys{\n"
+            "${KEYS_INITIALIZER}"
             "};\n"
+            "\n"
+            "constexpr std::array<Resource, ${RESOURCE_COUNT}> resources{\n"
+            "${RESOURCES_INITIALIZER}"
+            "};\n"
+            "\n"
+            "}  // namespace\n"
+            "\n"
+        )
+
+        file(READ "${ADD_RESOURCES_MODULE_DIR}/AddResourcesLookup.cpp.in" LOOKUP_TEMPLATE)
+        string(CONFIGURE "${LOOKUP_TEMPLATE}" LOOKUP_SOURCE @ONLY)
+
+        file(
+            APPEND "${OUT_SOURCE_FILE}"
+
+            "${LOOKUP_SOURCE}"
         )
 
         if(DEFINED ARGS_NAMESPACE)
@@ -0,0 +1,226 @@
+#include "changed_path_filters.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <unordered_set>
+
+#include <mcl/assert.hpp>
+
+#include "file_io.hpp"
+
+namespace libellus {
+
+namespace {
+
+// The same parameters as git's changed-path filters: ten bits and seven hashes per path give about a 1% false
+// positive rate, and a commit that changed more paths than are worth filtering gets a filter that matches anything.
+constexpr size_t bits_per_path = 10;
+constexpr size_t hashes_per_path = 7;
+constexpr size_t max_changed_paths = 512;
+
+// The file is a header followed by one record per commit: its Oid, a u32 filter size, then the filter. Native byte order.
+constexpr std::string_view magic = "LBCP";
+constexpr u32 version = 1;
+
+u32 rotl32(u32 x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+// MurmurHash3 (x86, 32-bit). Filters are saved to disk, so this must not change between builds the way std::hash may.
+u32 murmur3(u32 seed, std::string_view data)
+{
+    constexpr u32 c1 = 0xcc9e2d51;
+    constexpr u32 c2 = 0x1b873593;
+
+    u32 h = seed;
+    const size_t blocks = data.size() / 4;
+    for (size_t i = 0; i < blocks; ++i) {
+        u32 k = (u32)(u8)data[i * 4] | ((u32)(u8)data[i * 4 + 1] << 8) | ((u32)(u8)data[i * 4 + 2] << 16) | ((u32)(u8)data[i * 4 + 3] << 24);
+        k *= c1;
+        k = rotl32(k, 15);
+        k *= c2;
+        h ^= k;
+        h = rotl32(h, 13);
+        h = h * 5 + 0xe6546b64;
+    }
+
+    u32 k = 0;
+    const std::string_view tail = data.substr(blocks * 4);
+    switch (tail.size()) {
+    case 3:
+        k ^= (u32)(u8)tail[2] << 16;
+        [[fallthrough]];
+    case 2:
+        k ^= (u32)(u8)tail[1] << 8;
+        [[fallthrough]];
+    case 1:
+        k ^= (u32)(u8)tail[0];
+        k *= c1;
+        k = rotl32(k, 15);
+        k *= c2;
+        h ^= k;
+    }
+
+    h ^= (u32)data.size();
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+// Calls `f` with each bit `path` sets in a filter of `bits` bits, by double hashing.
+template<typename F>
+void for_each_bit(std::string_view path, size_t bits, F f)
+{
+    const u32 h1 = murmur3(0x293ae76f, path);
+    const u32 h2 = murmur3(0x7e646e2c, path);
+    for (u32 i = 0; i < hashes_per_path; ++i) {
+        f((h1 + i * h2) % bits);
+    }
+}
+
+}  // namespace
+
+ChangedPathFilters ChangedPathFilters::load(const std::filesystem::path& file)
+{
+    ChangedPathFilters result;
+
+    std::ifstream in{file, std::ios::binary};
+    if (!in) {
+        return result;
+    }
+    const std::string contents{std::istreambuf_iterator<char>{in}, {}};
+    std::string_view rest = contents;
+
+    // Consumes one value from the front of `rest`, or fails if there is not enough left.
+    const auto get = [&rest](auto& value) {
+        if (rest.size() < sizeof(value)) {
+            return false;
+        }
+        std::memcpy(&value, rest.data(), sizeof(value));
+        rest.remove_prefix(sizeof(value));
+        return true;
+    };
+
+    if (!rest.starts_with(magic)) {
+        return result;
+    }
+    rest.remove_prefix(magic.size());
+
+    u32 file_version;
+    if (!get(file_version) || file_version != version) {
+        return result;
+    }
+
+    while (!rest.empty()) {
+        Oid commit;
+        u32 size;
+        if (!get(commit.oid) || !get(size) || size == 0 || rest.size() < size) {
+            return ChangedPathFilters{};
+        }
+        result.filters.insert_or_assign(commit, std::string{rest.substr(0, size)});
+        rest.remove_prefix(size);
+    }
+
+    return result;
+}
+
+std::shared_ptr<const ChangedPathFilters> ChangedPathFilters::load_shared(const std::filesystem::path& file)
+{
+    struct Loaded {
+        std::optional<std::filesystem::file_time_type> time;
+        std::shared_ptr<const ChangedPathFilters> filters;
+    };
+    static std::mutex mutex;
+    static std::unordered_map<std::string, Loaded> loaded;
+
+    std::error_code ec;
+    const auto time = std::filesystem::last_write_time(file, ec);
+    const auto current_time = ec ? std::nullopt : std::optional{time};
+
+    std::lock_guard lock{mutex};
+    auto& entry = loaded[file.string()];
+    if (!entry.filters || entry.time != current_time) {
+        entry = Loaded{current_time, std::make_shared<const ChangedPathFilters>(load(file))};
+    }
+    return entry.filters;
+}
+
+void ChangedPathFilters::save(const std::filesystem::path& file) const
+{
+    std::string contents{magic};
+    put<u32>(contents, version);
+    for (const auto& [commit, filter] : filters) {
+        contents.append((const char*)commit.oid.data(), commit.oid.size());
+        put<u32>(contents, (u32)filter.size());
+        contents += filter;
+    }
+
+    // A name of its own, so that another process saving at the same time cannot write into the same file.
+    std::string temporary = file.string() + ".XXXXXX";
+    const int fd = ::mkstemp(temporary.data());
+    ASSERT_MSG(fd >= 0, "cannot create {}: {}", temporary, std::strerror(errno));
+    ::fchmod(fd, 0644);
+    write_all(fd, contents, temporary);
+    ASSERT_MSG(::fsync(fd) == 0, "cannot sync {}: {}", temporary, std::strerror(errno));
+    ::close(fd);
+
+    std::filesystem::rename(temporary, file);
+    sync_parent_directory(file);
+}
+
+bool ChangedPathFilters::maybe_changed(const Oid& commit, std::string_view path) const
+{
+    const auto iter = filters.find(commit);
+    if (iter == filters.end()) {
+        return true;
+    }
+
+    const std::string& filter = iter->second;
+    bool result = true;
+    for_each_bit(path, filter.size() * 8, [&](size_t bit) {
+        result = result && ((u8)filter[bit / 8] & (1 << (bit % 8)));
+    });
+    return result;
+}
+
+void ChangedPathFilters::add(const Oid& commit, const std::vector<Repository::PathChange>& changes)
+{
+    // Views into `changes`, which outlives this set.
+    std::unordered_set<std::string_view> paths;
+    for (const auto& change : changes) {
+        for (std::string_view path = change.path; !path.empty();) {
+            if (!paths.emplace(path).second) {
+                break;  // So were the directories above it
+            }
+            const size_t slash = path.rfind('/');
+            path = slash == std::string_view::npos ? std::string_view{} : path.substr(0, slash);
+        }
+    }
+
+    if (paths.size() > max_changed_paths) {
+        filters.insert_or_assign(commit, std::string(1, '\xFF'));
+        return;
+    }
+
+    std::string filter(std::max<size_t>(1, (paths.size() * bits_per_path + 7) / 8), '\0');
+    for (const std::string_view path : paths) {
+        for_each_bit(path, filter.size() * 8, [&](size_t bit) {
+            filter[bit / 8] = (char)((u8)filter[bit / 8] | (1 << (bit % 8)));
+        });
+    }
+    filters.insert_or_assign(commit, std::move(filter));
+}
+
+}  // namespace libellus
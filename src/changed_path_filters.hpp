@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mcl/stdint.hpp>
+
+#include "repository.hpp"
+
+namespace libellus {
+
+/// A Bloom filter per commit of the paths it changed relative to its first parent, directories included, in the
+/// spirit of the changed-path filters in git's commit-graph. A query answers either "definitely not changed" or
+/// "maybe changed", so a walk over the history of one path only has to compare trees for the few commits that
+/// may have changed it. A filter describes one commit forever, so filters are only ever added.
+class ChangedPathFilters {
+public:
+    /// Reads filters written by save(). A missing or malformed file reads as no filters at all.
+    static ChangedPathFilters load(const std::filesystem::path& file);
+    /// Like load(), but the filters are read once per process and shared by every caller until `file` changes.
+    static std::shared_ptr<const ChangedPathFilters> load_shared(const std::filesystem::path& file);
+    /// Replaces `file` atomically and durably, so that readers see either the old filters or the new ones. When
+    /// several processes save at once, the last one wins; filters missing as a result only make queries slower.
+    void save(const std::filesystem::path& file) const;
+
+    bool contains(const Oid& commit) const { return filters.contains(commit); }
+    size_t size() const { return filters.size(); }
+
+    /// False only if `commit` certainly left `path` as it was. True for commits without a filter.
+    /// `path` has no leading or trailing slashes, and must not be the root directory.
+    bool maybe_changed(const Oid& commit, std::string_view path) const;
+
+    /// Adds the filter of `commit` from the files it changed. The directories above them are added as well.
+    void add(const Oid& commit, const std::vector<Repository::PathChange>& changes);
+
+private:
+    struct OidHash {
+        size_t operator()(const Oid& oid) const
+        {
+            size_t result;
+            std::memcpy(&result, oid.oid.data(), sizeof(result));
+            return result;
+        }
+    };
+
+    std::unordered_map<Oid, std::string, OidHash> filters;
+};
+
+}  // namespace libellus
@@ -0,0 +1,160 @@
+#include "commit_log.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <fmt/chrono.h>
+#include <fmt/format.h>
+
+namespace libellus {
+
+Repository::CommitInfo CommitLog::Chunk::get(size_t index) const
+{
+    return Repository::CommitInfo{
+        .oid = oids[index],
+        .parents = {parents.begin() + parent_offsets[index], parents.begin() + parent_offsets[index + 1]},
+        .author_time = author_times[index],
+        .author = authors[author_ids[index]],
+        .summary = summaries.substr(summary_offsets[index], summary_offsets[index + 1] - summary_offsets[index]),
+    };
+}
+
+CommitLog::CommitLog(const std::string& repo_path, std::string_view refname)
+    : repo(repo_path, refname)
+{
+    thread = std::thread{[this] { run(); }};
+}
+
+CommitLog::~CommitLog()
+{
+    stopping = true;
+    requested = true;
+    requested.notify_one();
+    thread.join();
+}
+
+std::shared_ptr<const CommitLog::Log> CommitLog::load()
+{
+    // Only the first reader to find the thread idle needs to wake it.
+    if (!requested.exchange(true)) {
+        requested.notify_one();
+    }
+    return std::atomic_load(&log);
+}
+
+std::vector<Repository::CommitInfo> CommitLog::recent(size_t skip, size_t count)
+{
+    const auto current = load();
+    if (!current) {
+        return {};
+    }
+
+    std::vector<Repository::CommitInfo> result;
+    for (size_t i = skip; i < current->size && result.size() < count; ++i) {
+        result.emplace_back(current->get(current->size - 1 - i));
+    }
+    return result;
+}
+
+size_t CommitLog::skip_to(s64 time)
+{
+    const auto current = load();
+    if (!current) {
+        return 0;
+    }
+
+    // The latest author times are in order across chunks too, so the first later commit is in the first chunk that
+    // ends with a later one.
+    const auto& chunks = current->chunks;
+    const auto chunk = std::partition_point(chunks.begin(), chunks.end(), [time](const auto& c) { return c->latest_author_times.back() <= time; });
+    if (chunk == chunks.end()) {
+        return 0;
+    }
+    const auto& latest = (*chunk)->latest_author_times;
+    const size_t later = (size_t)(chunk - chunks.begin()) * Chunk::capacity + (size_t)(std::upper_bound(latest.begin(), latest.end(), time) - latest.begin());
+    return current->size - later;
+}
+
+void CommitLog::run()
+{
+    for (;;) {
+        // Cleared before stopping is checked, so that a request made after the check always ends the wait below.
+        requested = false;
+        if (stopping) {
+            return;
+        }
+        catch_up();
+
+        requested.wait(false);
+    }
+}
+
+void CommitLog::catch_up()
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    const auto snapshot = repo.snapshot();
+    const auto current = std::atomic_load(&log);
+    if (!snapshot.commit()) {
+        // Unborn, or since deleted.
+        if (!current || current->size != 0) {
+            std::atomic_store(&log, std::make_shared<const Log>());
+        }
+        return;
+    }
+    const Oid& head = *snapshot.commit();
+    if (current && current->size != 0 && current->head() == head) {
+        return;
+    }
+
+    // The next log starts out sharing every chunk with the current one, which its readers keep as it is.
+    auto next = current ? std::make_shared<Log>(*current) : std::make_shared<Log>();
+    std::shared_ptr<Chunk> tail;
+    const auto append_commit = [&](const Repository::CommitInfo& commit) { append(*next, tail, commit); };
+    if (!repo.first_parent_commits(next->size != 0 ? std::optional{next->head()} : std::nullopt, head, append_commit)) {
+        // The ref was rewritten, so the history the log followed is gone.
+        next = std::make_shared<Log>();
+        tail = nullptr;
+        repo.first_parent_commits(std::nullopt, head, append_commit);
+    }
+    if (!current) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        fmt::print("commit log: loaded {} commits in {}\n", next->size, elapsed);
+    }
+
+    std::atomic_store(&log, std::shared_ptr<const Log>{std::move(next)});
+}
+
+void CommitLog::append(Log& log, std::shared_ptr<Chunk>& tail, const Repository::CommitInfo& commit)
+{
+    const s64 latest_author_time = log.size != 0 ? std::max(log.chunks.back()->latest_author_times.back(), commit.author_time) : commit.author_time;
+
+    if (log.size % Chunk::capacity == 0) {
+        tail = std::make_shared<Chunk>();
+        log.chunks.emplace_back(tail);
+    } else if (!tail) {
+        tail = std::make_shared<Chunk>(*log.chunks.back());
+        log.chunks.back() = tail;
+    }
+    ++log.size;
+
+    Chunk& chunk = *tail;
+    chunk.oids.emplace_back(commit.oid);
+
+    chunk.parents.insert(chunk.parents.end(), commit.parents.begin(), commit.parents.end());
+    chunk.parent_offsets.emplace_back((u32)chunk.parents.size());
+
+    chunk.author_times.emplace_back(commit.author_time);
+    chunk.latest_author_times.emplace_back(latest_author_time);
+
+    const auto [iter, inserted] = chunk.author_lookup.try_emplace(commit.author, (u32)chunk.authors.size());
+    if (inserted) {
+        chunk.authors.emplace_back(commit.author);
+    }
+    chunk.author_ids.emplace_back(iter->second);
+
+    chunk.summaries += commit.summary;
+    chunk.summary_offsets.emplace_back(chunk.summaries.size());
+}
+
+}  // namespace libellus
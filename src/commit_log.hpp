@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <mcl/stdint.hpp>
+
+#include "repository.hpp"
+
+namespace libellus {
+
+/// The metadata of every commit along the first-parent history of a ref, oldest first, held in columns so that
+/// history pages are answered by index and binary search instead of a revwalk that parses each commit object.
+/// A thread of its own loads it at startup, then appends to it as the ref moves forward, publishing each version
+/// whole. Readers never wait for it, nor take a lock. Safe to share between threads.
+class CommitLog {
+public:
+    CommitLog(const std::string& repo_path, std::string_view refname);
+    ~CommitLog();
+
+    CommitLog(const CommitLog&) = delete;
+    CommitLog& operator=(const CommitLog&) = delete;
+
+    /// Up to `count` commits, newest first, after skipping the `skip` newest. Commits made since the log was last
+    /// published show up once the thread, which this wakes, has appended them; until the first load, there are none.
+    std::vector<Repository::CommitInfo> recent(size_t skip, size_t count);
+
+    /// How many of the newest commits to skip for recent() to start with the commit that was current at `time`, in
+    /// seconds since the epoch: the one just before the first commit authored later. Every commit if there is none.
+    size_t skip_to(s64 time);
+
+private:
+    /// A run of consecutive commits, with one entry per commit in each column except where noted. Every chunk of a
+    /// log holds `capacity` commits but the last, which is the only one ever appended to, and then only as a copy.
+    struct Chunk {
+        static constexpr size_t capacity = 4096;
+
+        std::vector<Oid> oids;
+        /// The parents of commit i are parents[parent_offsets[i]] up to parents[parent_offsets[i + 1]].
+        std::vector<u32> parent_offsets{0};
+        std::vector<Oid> parents;
+        std::vector<s64> author_times;
+        /// The greatest author time in the whole log up to and including each commit. Author times are not
+        /// necessarily in order, but these are, so they can be binary searched.
+        std::vector<s64> latest_author_times;
+        std::vector<u32> author_ids;
+        /// The summary of commit i is summaries[summary_offsets[i]] up to summaries[summary_offsets[i + 1]].
+        std::vector<u64> summary_offsets{0};
+        std::string summaries;
+
+        /// Authors are few compared to commits, so each is stored once per chunk.
+        std::vector<std::string> authors;
+        std::unordered_map<std::string, u32> author_lookup;
+
+        Repository::CommitInfo get(size_t index) const;
+    };
+
+    /// The whole log as of one commit. Immutable once published.
+    struct Log {
+        std::vector<std::shared_ptr<const Chunk>> chunks;  // Oldest first
+        size_t size = 0;
+
+        const Oid& head() const { return chunks.back()->oids.back(); }
+        Repository::CommitInfo get(size_t index) const { return chunks[index / Chunk::capacity]->get(index % Chunk::capacity); }
+    };
+
+    /// The published log, after waking the thread to append whatever the ref has gained since.
+    std::shared_ptr<const Log> load();
+
+    void run();
+    /// Publishes a log for the current head of the ref, if the published one is not for it already.
+    void catch_up();
+    /// Appends `commit` to `log`. `tail` is its last chunk if that belongs to `log` alone, and null while the last
+    /// chunk is still shared with a published log, in which case it is copied first.
+    static void append(Log& log, std::shared_ptr<Chunk>& tail, const Repository::CommitInfo& commit);
+
+    Repository repo;  // Only used by the thread
+    /// Null until the first load is done. Only accessed through std::atomic_load and std::atomic_store, as
+    /// std::atomic<std::shared_ptr> is missing from some standard libraries.
+    std::shared_ptr<const Log> log;
+
+    std::atomic<bool> requested = false;
+    std::atomic<bool> stopping = false;
+    std::thread thread;
+};
+
+}  // namespace libellus
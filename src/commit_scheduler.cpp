@@ -0,0 +1,175 @@
+#include "commit_scheduler.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include <fmt/format.h>
+#include <mcl/assert.hpp>
+
+namespace libellus {
+
+CommitScheduler::CommitScheduler(const std::string& repo_path, std::string_view refname, bool stage_writes, std::chrono::microseconds window, size_t batch_size,
+                                 const std::string& journal_path)
+    : repo(repo_path, refname, stage_writes)
+    , window(window)
+    , batch_size(batch_size)
+    , work(boost::asio::make_work_guard(ioc))
+    , timer(ioc)
+{
+    ASSERT(batch_size > 0);
+
+    if (!journal_path.empty()) {
+        journal.emplace(journal_path);
+
+        auto unapplied = journal->take_unapplied();
+        if (!unapplied.empty()) {
+            fmt::print("journal: replaying {} writes\n", unapplied.size());
+        }
+        for (auto& [sequence, write] : unapplied) {
+            enqueue(Pending{std::move(write), {}, sequence});
+        }
+    }
+
+    thread = std::thread{[this] { ioc.run(); }};
+}
+
+CommitScheduler::~CommitScheduler()
+{
+    // Writes still being synced are handed over before the final flush.
+    if (journal) {
+        journal->close();
+    }
+
+    boost::asio::post(ioc, [this] {
+        timer.cancel();
+        flush();
+    });
+    work.reset();
+    thread.join();
+}
+
+void CommitScheduler::submit(WriteRequest write, std::function<void(const CommitResult&)> complete)
+{
+    enqueue(Pending{std::move(write), std::move(complete), std::nullopt});
+}
+
+void CommitScheduler::append_to_journal(WriteRequest write, std::function<void(u64)> durable)
+{
+    ASSERT(journal);
+
+    // The journal calls back in sequence order from a single thread, so writes reach `pending` in that order too.
+    journal->append(std::move(write), [this, durable = std::move(durable)](u64 sequence, WriteRequest write) {
+        enqueue(Pending{std::move(write), {}, sequence});
+        durable(sequence);
+    });
+}
+
+void CommitScheduler::enqueue(Pending p)
+{
+    boost::asio::post(ioc, [this, p = std::move(p)]() mutable {
+        pending.emplace_back(std::move(p));
+
+        if (pending.size() >= batch_size) {
+            timer.cancel();
+            flush();
+        } else if (pending.size() == 1) {
+            // A zero window still batches whatever was queued on the io_context behind this write.
+            timer.expires_after(window);
+            timer.async_wait([this](const boost::system::error_code& ec) {
+                if (ec != boost::asio::error::operation_aborted) {
+                    flush();
+                }
+            });
+        }
+    });
+}
+
+void CommitScheduler::flush()
+{
+    if (pending.empty()) {
+        return;
+    }
+
+    const std::vector<Pending> batch = std::exchange(pending, {});
+
+    const auto committed = this->commit(batch);
+    if (committed) {
+        for (const auto& p : batch) {
+            if (p.complete) {
+                p.complete(committed);
+            }
+        }
+    } else {
+        // Some write in the batch conflicts with another writer or does not apply. Commit them one at a time so
+        // only that one fails.
+        for (const auto& p : batch) {
+            auto commit = batch.size() == 1 ? committed : this->commit({&p, 1});
+            // A journaled write has been acknowledged already, so it goes on top of whatever the other writer did,
+            // for as long as a writer that keeps touching the same paths lets it.
+            for (size_t attempt = 1; attempt < max_journaled_attempts && !commit && commit.error().kind == CommitError::Kind::Conflict && p.journal_sequence; ++attempt) {
+                commit = this->commit({&p, 1});
+            }
+            // Nor can it be rejected, so one that no longer applies, such as a rename of a path since removed, or
+            // that kept conflicting, is dropped rather than retried forever.
+            if (!commit && p.journal_sequence) {
+                fmt::print(stderr, "journal: dropping write {}: {}\n", *p.journal_sequence, commit.error().message);
+            }
+            if (p.complete) {
+                p.complete(commit);
+            }
+        }
+    }
+
+    if (journal) {
+        const auto last_journaled = std::find_if(batch.rbegin(), batch.rend(), [](const Pending& p) { return p.journal_sequence.has_value(); });
+        if (last_journaled != batch.rend()) {
+            journal->mark_applied(*last_journaled->journal_sequence);
+        }
+    }
+}
+
+CommitResult CommitScheduler::commit(std::span<const Pending> batch)
+{
+    // Writes are applied in arrival order, so a later write to the same path wins as if each had its own commit.
+    Transaction transaction = repo.transaction();
+    for (const auto& p : batch) {
+        for (const auto& change : p.write.changes) {
+            switch (change.kind) {
+            case Change::Kind::Upsert:
+                transaction.upsert(change.path, change.data);
+                break;
+            case Change::Kind::Remove:
+                transaction.remove(change.path);
+                break;
+            case Change::Kind::Rename:
+                transaction.rename(change.path, change.data);
+                break;
+            case Change::Kind::UpsertBlob:
+                transaction.upsert(change.path, change.blob);
+                break;
+            }
+        }
+    }
+
+    std::string message;
+    if (batch.size() == 1) {
+        message = batch[0].write.message;
+    } else {
+        message = fmt::format("Apply {} edits\n\n", batch.size());
+        for (const auto& p : batch) {
+            fmt::format_to(std::back_inserter(message), "* {}\n", p.write.message);
+        }
+    }
+
+    if (transaction.empty()) {
+        // Nothing changed, so every write in the batch is already in the current commit, if there is one yet.
+        if (const auto head = repo.snapshot().commit()) {
+            return *head;
+        }
+        return CommitError{CommitError::Kind::Invalid, "nothing to commit"};
+    }
+    return repo.commit(message, transaction);
+}
+
+}  // namespace libellus
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <mcl/stdint.hpp>
+
+#include "journal.hpp"
+#include "repository.hpp"
+#include "write_request.hpp"
+
+namespace libellus {
+
+/// Commits writes from every worker through one Repository on a thread of its own. Writes that arrive within
+/// `window` of the first pending one are applied as a single transaction and share a commit, up to `batch_size`
+/// writes per commit, so that concurrent writers split the cost of rebuilding trees and updating the ref.
+///
+/// Given a `journal_path`, writes can instead be acknowledged as soon as they are in the journal, and this thread
+/// becomes the applier that folds them into commits. Entries left in the journal by a previous run are applied first.
+class CommitScheduler {
+public:
+    CommitScheduler(const std::string& repo_path, std::string_view refname, bool stage_writes, std::chrono::microseconds window, size_t batch_size,
+                    const std::string& journal_path = {});
+    ~CommitScheduler();
+
+    CommitScheduler(const CommitScheduler&) = delete;
+    CommitScheduler& operator=(const CommitScheduler&) = delete;
+
+    /// Completes with the commit that includes `write`, on the executor associated with the handler, or with why
+    /// there is none: another writer changed the same paths first, or `write` does not apply to the tree.
+    template<typename CompletionToken>
+    auto async_commit(WriteRequest write, CompletionToken&& token)
+    {
+        return boost::asio::async_initiate<CompletionToken, void(CommitResult)>(
+            [this](auto handler, WriteRequest write) {
+                auto work = boost::asio::make_work_guard(handler);
+                auto shared_handler = std::make_shared<decltype(handler)>(std::move(handler));
+                submit(std::move(write), [shared_handler, work](const CommitResult& commit) mutable {
+                    boost::asio::post(work.get_executor(), [shared_handler, commit] { (*shared_handler)(commit); });
+                    work.reset();
+                });
+            },
+            token, std::move(write));
+    }
+
+    bool journaled() const { return journal.has_value(); }
+
+    /// Completes with the sequence number of `write` as soon as it is durable in the journal, on the executor
+    /// associated with the handler. It is committed later; having been acknowledged, it is applied on top of
+    /// another writer's changes to the same paths rather than rejected. Requires a journal.
+    template<typename CompletionToken>
+    auto async_journal(WriteRequest write, CompletionToken&& token)
+    {
+        return boost::asio::async_initiate<CompletionToken, void(u64)>(
+            [this](auto handler, WriteRequest write) {
+                auto work = boost::asio::make_work_guard(handler);
+                auto shared_handler = std::make_shared<decltype(handler)>(std::move(handler));
+                append_to_journal(std::move(write), [shared_handler, work](u64 sequence) mutable {
+                    boost::asio::post(work.get_executor(), [shared_handler, sequence] { (*shared_handler)(sequence); });
+                    work.reset();
+                });
+            },
+            token, std::move(write));
+    }
+
+private:
+    struct Pending {
+        WriteRequest write;
+        std::function<void(const CommitResult&)> complete;  // Empty for journaled writes
+        std::optional<u64> journal_sequence;
+    };
+
+    void submit(WriteRequest write, std::function<void(const CommitResult&)> complete);
+    void append_to_journal(WriteRequest write, std::function<void(u64)> durable);
+    void enqueue(Pending p);
+    void flush();
+    CommitResult commit(std::span<const Pending> batch);
+
+    /// Gives up on a journaled write that still conflicts after this many commits of it on its own.
+    static constexpr size_t max_journaled_attempts = 8;
+
+    Repository repo;
+    std::chrono::microseconds window;
+    size_t batch_size;
+
+    boost::asio::io_context ioc{1};
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    boost::asio::steady_timer timer;
+    std::vector<Pending> pending;
+    std::optional<Journal> journal;
+    std::thread thread;
+};
+
+}  // namespace libellus
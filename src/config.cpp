@@ -0,0 +1,140 @@
+#include "config.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string_view>
+#include <thread>
+
+#include <fmt/format.h>
+
+namespace libellus {
+
+namespace {
+
+[[noreturn]] void usage(const char* argv0)
+{
+    fmt::print(stderr,
+               "usage: {0} [options]\n"
+               "       {0} import <dir> [options]\n"
+               "\n"
+               "import commits every file under <dir> at once and repacks the repository, pruning unreachable\n"
+               "objects older than an hour; do not run it while a server is writing to the same repository.\n"
+               "\n"
+               "  --address <addr>        address to listen on (default: 0.0.0.0)\n"
+               "  --port <port>           port to listen on (default: 54321)\n"
+               "  --threads <n>           number of worker threads (default: one per core)\n"
+               "  --repository <dir>      path of the git repository to serve (default: .)\n"
+               "  --ref <refname>         reference to serve and commit to (default: refs/heads/main)\n"
+               "  --path-index <on|off>   index every path of the current commit on each worker (default: off)\n"
+               "  --last-modified <on|off> show when each entry of a listing last changed (default: off)\n"
+               "  --commit-log <on|off>   serve recent changes at /changes from commits held in memory (default: off)\n"
+               "  --history <on|off>      serve the commits that changed a path at <path>?history (default: off)\n"
+               "  --manifest <on|off>     serve every file under a directory at <dir>?files (default: off)\n"
+               "  --listing-cache <mib>   memory for rendered directory listings (default: 64)\n"
+               "  --commit-window <ms>    time to gather concurrent writes into one commit (default: 5)\n"
+               "  --commit-batch <n>      most writes per commit (default: 128)\n"
+               "  --object-writes <mode>  'loose' or 'packed' objects for new commits (default: loose)\n"
+               "  --journal <file>        acknowledge writes once journaled in <file>, committing them later\n"
+               "  --upload-limit <mib>    largest upload accepted, 0 for no limit (default: 1024)\n"
+               "  --maintenance <min>     minutes between repository maintenance checks, 0 to disable (default: 10)\n",
+               argv0);
+    std::exit(EXIT_FAILURE);
+}
+
+// The number `str` times `scale`, which converts from the unit the option is given in. Anything that is not a
+// number, or does not fit in T once scaled, gets the usage message.
+template<typename T>
+T parse_number_option(const char* argv0, std::string_view str, T scale = 1)
+{
+    const auto result = parse_number<T>(str);
+    if (!result || *result > std::numeric_limits<T>::max() / scale) {
+        usage(argv0);
+    }
+    return *result * scale;
+}
+
+bool parse_switch(const char* argv0, std::string_view value)
+{
+    if (value != "on" && value != "off") {
+        usage(argv0);
+    }
+    return value == "on";
+}
+
+}  // namespace
+
+Config parse_config(int argc, char** argv)
+{
+    Config config;
+
+    int first_option = 1;
+    if (argc >= 2 && std::string_view{argv[1]} == "import") {
+        if (argc < 3) {
+            usage(argv[0]);
+        }
+        config.import_source = argv[2];
+        first_option = 3;
+    }
+
+    for (int i = first_option; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const std::string_view value = argv[++i];
+
+        if (arg == "--address") {
+            config.address = value;
+        } else if (arg == "--port") {
+            config.port = parse_number_option<u16>(argv[0], value);
+        } else if (arg == "--threads") {
+            config.threads = parse_number_option<size_t>(argv[0], value);
+        } else if (arg == "--repository") {
+            config.repository_path = value;
+        } else if (arg == "--ref") {
+            config.refname = value;
+        } else if (arg == "--path-index") {
+            config.path_index = parse_switch(argv[0], value);
+        } else if (arg == "--last-modified") {
+            config.last_modified = parse_switch(argv[0], value);
+        } else if (arg == "--commit-log") {
+            config.commit_log = parse_switch(argv[0], value);
+        } else if (arg == "--history") {
+            config.history = parse_switch(argv[0], value);
+        } else if (arg == "--manifest") {
+            config.file_manifest = parse_switch(argv[0], value);
+        } else if (arg == "--listing-cache") {
+            config.listing_cache_size = parse_number_option<size_t>(argv[0], value, 1024 * 1024);
+        } else if (arg == "--commit-window") {
+            config.commit_window = parse_number_option<u32>(argv[0], value, 1000);
+        } else if (arg == "--commit-batch") {
+            config.commit_batch = parse_number_option<size_t>(argv[0], value);
+            if (config.commit_batch == 0) {
+                usage(argv[0]);
+            }
+        } else if (arg == "--object-writes") {
+            if (value != "loose" && value != "packed") {
+                usage(argv[0]);
+            }
+            config.pack_writes = value == "packed";
+        } else if (arg == "--journal") {
+            config.journal_path = value;
+        } else if (arg == "--upload-limit") {
+            config.upload_limit = parse_number_option<u64>(argv[0], value, 1024 * 1024);
+        } else if (arg == "--maintenance") {
+            config.maintenance_interval = parse_number_option<u32>(argv[0], value, 60);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (config.threads == 0) {
+        config.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    return config;
+}
+
+}  // namespace libellus
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <charconv>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <mcl/stdint.hpp>
+
+namespace libellus {
+
+/// `str` as a decimal number, or nullopt unless all of it is one that fits in T.
+template<typename T>
+std::optional<T> parse_number(std::string_view str)
+{
+    T result{};
+    const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), result);
+    if (ec != std::errc{} || ptr != str.data() + str.size()) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+struct Config {
+    /// Set by the import subcommand: the directory whose files are committed instead of serving the repository.
+    std::string import_source;
+    std::string address = "0.0.0.0";
+    u16 port = 54321;
+    std::string repository_path = ".";
+    std::string refname = "refs/heads/main";
+    /// Number of worker threads, each running its own io_context. Zero selects one per hardware thread.
+    size_t threads = 0;
+    /// Keep every path of the current commit in a hash index on each worker, trading memory for faster lookups.
+    bool path_index = false;
+    /// Index the commit that last changed every path, so that listings can show it.
+    bool last_modified = false;
+    /// Keep the metadata of every commit in memory and serve pages of recent changes at /changes.
+    bool commit_log = false;
+    /// Serve pages of the commits that changed a file or directory at <path>?history, walked on a thread of their own.
+    bool history = false;
+    /// Serve the list of every file under a directory at <dir>?files, walking its subtrees on several threads.
+    bool file_manifest = false;
+    /// Upper bound on the total size of rendered directory listings kept in memory, in bytes.
+    size_t listing_cache_size = 64 * 1024 * 1024;
+    /// How long the first pending write waits for others to share its commit, in microseconds.
+    u32 commit_window = 5000;
+    /// Most writes folded into a single commit.
+    size_t commit_batch = 128;
+    /// Stage new objects in memory and write each commit's objects as one packfile rather than as loose objects.
+    bool pack_writes = false;
+    /// File in which writes are journaled and acknowledged before they are committed. Empty commits every write first.
+    std::string journal_path;
+    /// Largest upload body accepted, in bytes. Zero accepts any size.
+    u64 upload_limit = 1024ull * 1024 * 1024;
+    /// How often to check whether the repository needs repacking, in seconds. Zero disables maintenance.
+    u32 maintenance_interval = 600;
+};
+
+Config parse_config(int argc, char** argv);
+
+}  // namespace libellus
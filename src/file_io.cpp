@@ -0,0 +1,34 @@
+#include "file_io.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <mcl/assert.hpp>
+
+namespace libellus {
+
+void write_all(int fd, std::string_view data, const std::string& name)
+{
+    while (!data.empty()) {
+        const ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        ASSERT_MSG(written > 0, "cannot write {}: {}", name, std::strerror(errno));
+        data.remove_prefix((size_t)written);
+    }
+}
+
+void sync_parent_directory(const std::filesystem::path& path)
+{
+    const auto parent = std::filesystem::absolute(path).parent_path();
+    const int dir = ::open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ASSERT_MSG(dir >= 0, "cannot open {}: {}", parent.string(), std::strerror(errno));
+    ASSERT_MSG(::fsync(dir) == 0, "cannot sync {}: {}", parent.string(), std::strerror(errno));
+    ::close(dir);
+}
+
+}  // namespace libellus
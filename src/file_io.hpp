@@ -0,0 +1,23 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace libellus {
+
+/// Appends the bytes of `value` to `out` in native byte order, for the binary files libellus writes itself.
+template<typename T>
+void put(std::string& out, T value)
+{
+    out.append((const char*)&value, sizeof(value));
+}
+
+/// Writes all of `data` to `fd`, however many write calls it takes. `name` is the file written, for the message if
+/// writing fails.
+void write_all(int fd, std::string_view data, const std::string& name);
+
+/// Makes the directory entry of `path`, newly created or renamed into place, durable; syncing the file itself does not.
+void sync_parent_directory(const std::filesystem::path& path);
+
+}  // namespace libellus
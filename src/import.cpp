@@ -0,0 +1,146 @@
+#include "import.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fmt/chrono.h>
+#include <fmt/format.h>
+#include <mcl/stdint.hpp>
+
+#include "maintenance.hpp"
+#include "repository.hpp"
+
+namespace libellus {
+
+namespace {
+
+// Each thread dumps its staged blobs as a pack once they add up to this much, to bound memory use.
+constexpr size_t staged_bytes_per_pack = 256 * 1024 * 1024;
+
+struct ImportedFile {
+    std::filesystem::path source;
+    std::string path;  // Path in the repository, with '/' separators
+    bool executable;
+    Oid blob;
+};
+
+std::optional<std::string> read_file(const std::filesystem::path& path)
+{
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+        return std::nullopt;
+    }
+    return std::string{std::istreambuf_iterator<char>{file}, {}};
+}
+
+}  // namespace
+
+int run_import(const Config& config, const std::string& source)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<ImportedFile> files;
+    {
+        std::error_code ec;
+        std::filesystem::recursive_directory_iterator iter{source, ec}, end;
+        for (; iter != end && !ec; iter.increment(ec)) {
+            if (iter->path().filename() == ".git") {
+                iter.disable_recursion_pending();
+                continue;
+            }
+            if (iter->is_regular_file(ec)) {
+                // Git only records whether a file is executable, and takes the owner's bit for it.
+                const bool executable = (iter->status(ec).permissions() & std::filesystem::perms::owner_exec) != std::filesystem::perms::none;
+                files.emplace_back(ImportedFile{iter->path(), iter->path().lexically_relative(source).generic_string(), executable, {}});
+            }
+        }
+        if (ec) {
+            fmt::print(stderr, "import: cannot read {}: {}\n", source, ec.message());
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Each thread has a handle of its own that keeps blobs in memory, so that hashing and compressing them into
+    // packs happens on every core and no loose objects are written.
+    std::atomic<size_t> next_file = 0;
+    std::atomic<bool> failed = false;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < config.threads; ++i) {
+        threads.emplace_back([&] {
+            Repository repo{config.repository_path, config.refname, true};
+            size_t staged_bytes = 0;
+
+            for (size_t index = next_file++; index < files.size() && !failed; index = next_file++) {
+                auto& file = files[index];
+
+                const auto contents = read_file(file.source);
+                if (!contents) {
+                    fmt::print(stderr, "import: cannot read {}\n", file.source.string());
+                    failed = true;
+                    break;
+                }
+                file.blob = repo.write_blob(*contents);
+
+                staged_bytes += contents->size();
+                if (staged_bytes >= staged_bytes_per_pack) {
+                    repo.flush_staged_objects();
+                    staged_bytes = 0;
+                }
+            }
+
+            repo.flush_staged_objects();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (failed) {
+        return EXIT_FAILURE;
+    }
+
+    const auto hashed = std::chrono::steady_clock::now();
+
+    Repository repo{config.repository_path, config.refname, true};
+
+    // The whole set of changes is applied as one tree update, which builds each tree once from the bottom up.
+    Transaction transaction = repo.transaction();
+    for (const auto& file : files) {
+        transaction.upsert(file.path, file.blob, file.executable);
+    }
+    if (transaction.empty()) {
+        fmt::print("import: no files in {}\n", source);
+        return EXIT_SUCCESS;
+    }
+
+    const auto commit = repo.commit(fmt::format("Import {} files", files.size()), transaction);
+    if (!commit) {
+        fmt::print(stderr, "import: cannot commit to {}: {}\n", config.refname, commit.error().message);
+        return EXIT_FAILURE;
+    }
+
+    const auto committed = std::chrono::steady_clock::now();
+
+    // Folds whatever was in the repository before into one pack with the imported objects. The per-thread packs are
+    // as new as anything another process may be writing, so they are left for maintenance to remove once older.
+    const auto repacked = repo.repack(Maintenance::Thresholds{}.grace_period);
+    repo.write_commit_graph();
+    repo.write_changed_path_filters();
+
+    const auto elapsed = [](auto from, auto to) { return std::chrono::duration_cast<std::chrono::milliseconds>(to - from); };
+    fmt::print("import: committed {} files as {}; hashed in {}, built trees in {}, repacked {} objects in {}\n",
+               files.size(), commit->to_string(), elapsed(start, hashed), elapsed(hashed, committed), repacked.objects, elapsed(committed, std::chrono::steady_clock::now()));
+
+    return EXIT_SUCCESS;
+}
+
+}  // namespace libellus
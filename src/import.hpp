@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+#include "config.hpp"
+
+namespace libellus {
+
+/// Adds every file under `source` to the configured ref in a single commit. Blobs are read, hashed and compressed
+/// into packs on every worker thread at once; the trees are then built bottom-up in one pass and committed, and
+/// the repository is repacked into one pack. The ref may be unborn, as in a freshly initialised repository. Meant
+/// for seeding a repository while no server is running on it, as the repack prunes unreachable objects older than
+/// maintenance's grace period. Returns the process exit code.
+int run_import(const Config& config, const std::string& source);
+
+}  // namespace libellus
@@ -0,0 +1,304 @@
+#include "journal.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+#include <boost/asio/post.hpp>
+#include <mcl/assert.hpp>
+
+#include "file_io.hpp"
+
+namespace libellus {
+
+namespace {
+
+// Each record is a u32 payload size, the CRC-32 of the payload, then the payload itself, all in native byte order.
+// A record that is cut short or fails its checksum is the torn tail of an append that never completed.
+enum class RecordType : u8 {
+    Entry = 1,
+    Applied = 2,
+};
+
+constexpr std::array<u32, 256> crc32_table = [] {
+    std::array<u32, 256> table{};
+    for (u32 i = 0; i < 256; ++i) {
+        u32 crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+u32 crc32(std::string_view data)
+{
+    u32 crc = 0xFFFFFFFF;
+    for (const char c : data) {
+        crc = crc32_table[(crc ^ (u8)c) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void put_string(std::string& out, std::string_view str)
+{
+    put<u32>(out, (u32)str.size());
+    out.append(str);
+}
+
+void put_record(std::string& out, RecordType type, u64 sequence, const WriteRequest* write)
+{
+    std::string payload;
+    put<u8>(payload, (u8)type);
+    put<u64>(payload, sequence);
+    if (write) {
+        put_string(payload, write->message);
+        put<u32>(payload, (u32)write->changes.size());
+        for (const auto& change : write->changes) {
+            put<u8>(payload, (u8)change.kind);
+            put_string(payload, change.path);
+            put_string(payload, change.data);
+            if (change.kind == Change::Kind::UpsertBlob) {
+                payload.append((const char*)change.blob.oid.data(), change.blob.oid.size());
+            }
+        }
+    }
+
+    put<u32>(out, (u32)payload.size());
+    put<u32>(out, crc32(payload));
+    out += payload;
+}
+
+// Consumes values from the front of `in`; every getter returns nullopt once it runs out.
+struct Reader {
+    std::string_view in;
+
+    template<typename T>
+    std::optional<T> get()
+    {
+        if (in.size() < sizeof(T)) {
+            return std::nullopt;
+        }
+        T value;
+        std::memcpy(&value, in.data(), sizeof(T));
+        in.remove_prefix(sizeof(T));
+        return value;
+    }
+
+    std::optional<std::string> get_string()
+    {
+        const auto size = get<u32>();
+        if (!size || in.size() < *size) {
+            return std::nullopt;
+        }
+        std::string result{in.substr(0, *size)};
+        in.remove_prefix(*size);
+        return result;
+    }
+};
+
+std::optional<WriteRequest> get_write(Reader& reader)
+{
+    WriteRequest write;
+
+    auto message = reader.get_string();
+    const auto count = reader.get<u32>();
+    if (!message || !count) {
+        return std::nullopt;
+    }
+    write.message = std::move(*message);
+
+    for (u32 i = 0; i < *count; ++i) {
+        const auto kind = reader.get<u8>();
+        auto path = reader.get_string();
+        auto data = reader.get_string();
+        if (!kind || !path || !data || *kind > (u8)Change::Kind::UpsertBlob) {
+            return std::nullopt;
+        }
+
+        Change change{(Change::Kind)*kind, std::move(*path), std::move(*data)};
+        if (change.kind == Change::Kind::UpsertBlob) {
+            const auto blob = reader.get<decltype(Oid::oid)>();
+            if (!blob) {
+                return std::nullopt;
+            }
+            change.blob.oid = *blob;
+        }
+        write.changes.emplace_back(std::move(change));
+    }
+
+    return write;
+}
+
+}  // namespace
+
+Journal::Journal(const std::string& path)
+    : path(path)
+    , work(boost::asio::make_work_guard(ioc))
+{
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    ASSERT_MSG(fd >= 0, "cannot open journal {}: {}", path, std::strerror(errno));
+    sync_parent_directory(path);
+
+    recover();
+
+    // An emptied file no longer says how far the numbering got. Sequence numbers are handed out far more slowly than
+    // one per nanosecond, so starting from the clock stays ahead of any number issued before this start.
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+    next_sequence = std::max(next_sequence, (u64)now.count());
+
+    thread = std::thread{[this] { ioc.run(); }};
+}
+
+Journal::~Journal()
+{
+    close();
+    ::close(fd);
+}
+
+void Journal::recover()
+{
+    std::string contents;
+    {
+        std::array<char, 65536> buffer;
+        for (;;) {
+            const ssize_t got = ::pread(fd, buffer.data(), buffer.size(), (off_t)contents.size());
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            ASSERT_MSG(got >= 0, "journal read failed: {}", std::strerror(errno));
+            if (got == 0) {
+                break;
+            }
+            contents.append(buffer.data(), (size_t)got);
+        }
+    }
+
+    std::vector<Entry> entries;
+    Reader reader{contents};
+    size_t valid_size = 0;
+
+    for (;;) {
+        const auto size = reader.get<u32>();
+        const auto checksum = reader.get<u32>();
+        if (!size || !checksum || reader.in.size() < *size) {
+            break;
+        }
+        const std::string_view payload = reader.in.substr(0, *size);
+        if (crc32(payload) != *checksum) {
+            break;
+        }
+        reader.in.remove_prefix(*size);
+
+        Reader record{payload};
+        const auto type = record.get<u8>();
+        const auto sequence = record.get<u64>();
+        if (!type || !sequence) {
+            break;
+        }
+
+        if (*type == (u8)RecordType::Entry) {
+            auto write = get_write(record);
+            if (!write) {
+                break;
+            }
+            entries.emplace_back(*sequence, std::move(*write));
+        } else if (*type == (u8)RecordType::Applied) {
+            applied_sequence = std::max(applied_sequence, *sequence);
+        } else {
+            break;
+        }
+
+        next_sequence = std::max(next_sequence, *sequence + 1);
+        valid_size = contents.size() - reader.in.size();
+    }
+
+    // Drop a torn tail so that new records follow the last intact one.
+    if (valid_size != contents.size()) {
+        ASSERT_MSG(::ftruncate(fd, (off_t)valid_size) == 0, "journal truncate failed: {}", std::strerror(errno));
+    }
+
+    for (auto& entry : entries) {
+        if (entry.first > applied_sequence) {
+            unapplied.emplace_back(std::move(entry));
+        }
+    }
+}
+
+std::vector<Journal::Entry> Journal::take_unapplied()
+{
+    return std::exchange(unapplied, {});
+}
+
+void Journal::append(WriteRequest write, std::function<void(u64, WriteRequest)> durable)
+{
+    boost::asio::post(ioc, [this, q = Queued{std::move(write), std::move(durable)}]() mutable {
+        queued.emplace_back(std::move(q));
+
+        // Everything queued by the time this runs, including appends that arrive during the previous sync, shares it.
+        if (queued.size() == 1) {
+            boost::asio::post(ioc, [this] { sync(); });
+        }
+    });
+}
+
+void Journal::sync()
+{
+    std::vector<Queued> batch = std::exchange(queued, {});
+    std::vector<u64> sequences;
+    sequences.reserve(batch.size());
+
+    {
+        std::lock_guard lock{mutex};
+
+        std::string records;
+        for (const auto& q : batch) {
+            sequences.emplace_back(next_sequence++);
+            put_record(records, RecordType::Entry, sequences.back(), &q.write);
+        }
+        write_all(fd, records, path);
+    }
+
+    // Records are only ever written at the end of the file, so syncing data alone is enough; a torn tail is dropped on recovery.
+    ASSERT_MSG(::fdatasync(fd) == 0, "journal sync failed: {}", std::strerror(errno));
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        batch[i].durable(sequences[i], std::move(batch[i].write));
+    }
+}
+
+void Journal::mark_applied(u64 sequence)
+{
+    std::lock_guard lock{mutex};
+
+    applied_sequence = std::max(applied_sequence, sequence);
+
+    // Nothing else is outstanding, so the file can start over. Sequence numbers keep counting up regardless.
+    if (applied_sequence + 1 == next_sequence) {
+        ASSERT_MSG(::ftruncate(fd, 0) == 0, "journal truncate failed: {}", std::strerror(errno));
+        return;
+    }
+
+    std::string record;
+    put_record(record, RecordType::Applied, applied_sequence, nullptr);
+    write_all(fd, record, path);
+}
+
+void Journal::close()
+{
+    if (!thread.joinable()) {
+        return;
+    }
+    work.reset();
+    thread.join();
+}
+
+}  // namespace libellus
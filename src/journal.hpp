@@ -0,0 +1,77 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <mcl/stdint.hpp>
+
+#include "write_request.hpp"
+
+namespace libellus {
+
+/// An append-only file of writes that have been acknowledged but not necessarily committed yet. Appends that
+/// arrive while the previous batch is being synced share one sequential write and one fdatasync, so a write is
+/// durable long before its commit is. Entries that were never marked applied are handed back on the next start.
+///
+/// An entry is applied at least once: if the process dies after its commit but before the journal records that,
+/// it is applied again. Upserts and removes are idempotent, so this only costs an empty commit; a rename whose
+/// source is already gone no longer applies and is dropped by the applier.
+///
+/// Sequence numbers increase across restarts too, even once the file has been emptied, so that a client never
+/// sees one reused.
+class Journal {
+public:
+    using Entry = std::pair<u64, WriteRequest>;
+
+    explicit Journal(const std::string& path);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /// Entries left over from a previous run that were never marked applied, in the order they were appended.
+    /// Ownership passes to the caller; subsequent calls return nothing.
+    std::vector<Entry> take_unapplied();
+
+    /// Appends `write` and calls `durable` with its sequence number once it is on disk. `durable` is called on the
+    /// journal's own thread, in sequence order.
+    void append(WriteRequest write, std::function<void(u64, WriteRequest)> durable);
+
+    /// Records that every entry up to and including `sequence` has been committed. Once every entry has been,
+    /// the file is emptied. Unlike append, this is not synced: losing it only means entries are applied again.
+    void mark_applied(u64 sequence);
+
+    /// Syncs whatever has been appended so far and stops accepting appends. mark_applied remains usable.
+    void close();
+
+private:
+    struct Queued {
+        WriteRequest write;
+        std::function<void(u64, WriteRequest)> durable;
+    };
+
+    void recover();
+    void sync();
+
+    std::string path;
+    int fd = -1;
+
+    std::mutex mutex;  // Guards the file and the sequence numbers below
+    u64 next_sequence = 1;
+    u64 applied_sequence = 0;
+
+    std::vector<Entry> unapplied;
+
+    boost::asio::io_context ioc{1};
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    std::vector<Queued> queued;
+    std::thread thread;
+};
+
+}  // namespace libellus
@@ -0,0 +1,139 @@
+#include "last_modified.hpp"
+
+#include <chrono>
+
+#include <fmt/chrono.h>
+#include <fmt/format.h>
+
+namespace libellus {
+
+const LastModifiedIndex::Change* LastModifiedIndex::Table::find(std::string_view path) const
+{
+    const auto& shard = shards[shard_of(path)];
+    if (!shard) {
+        return nullptr;
+    }
+    const auto iter = shard->find(path);
+    return iter != shard->end() ? &iter->second : nullptr;
+}
+
+LastModifiedIndex::LastModifiedIndex(const std::string& repo_path, std::string_view refname)
+    : repo(repo_path, refname)
+{
+    thread = std::thread{[this] { run(); }};
+}
+
+LastModifiedIndex::~LastModifiedIndex()
+{
+    {
+        std::lock_guard lock{mutex};
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+std::shared_ptr<const LastModifiedIndex::Table> LastModifiedIndex::at(const Oid& commit)
+{
+    auto current = std::atomic_load(&table);
+    if (current && current->head == commit) {
+        return current;
+    }
+
+    // The ref may have moved past the published table. The lock is only ever held to flip a flag.
+    {
+        std::lock_guard lock{mutex};
+        requested = true;
+    }
+    wake.notify_one();
+    return nullptr;
+}
+
+void LastModifiedIndex::run()
+{
+    for (;;) {
+        catch_up();
+
+        std::unique_lock lock{mutex};
+        wake.wait(lock, [this] { return requested || stopping; });
+        if (stopping) {
+            return;
+        }
+        requested = false;
+    }
+}
+
+void LastModifiedIndex::catch_up()
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    const auto snapshot = repo.snapshot();
+    if (!snapshot.commit()) {
+        return;  // Nothing to index until the first commit
+    }
+    const Oid& head = *snapshot.commit();
+    const auto current = std::atomic_load(&table);
+    if (current && current->head == head) {
+        return;
+    }
+
+    // The next table starts out sharing every shard with the current one, which its readers keep as it is.
+    auto next = current ? std::make_shared<Table>(*current) : std::make_shared<Table>();
+    std::vector<bool> copied(Table::shard_count);
+    const auto apply_to_next = [&](const Oid& commit, s64 time, const std::vector<Repository::PathChange>& changes) {
+        apply(*next, copied, commit, time, changes);
+    };
+    if (!current || !repo.first_parent_changes(current->head, head, apply_to_next)) {
+        // Either the first build, or the ref was rewritten and the history the index followed is gone.
+        next = std::make_shared<Table>();
+        copied.assign(Table::shard_count, false);
+        repo.first_parent_changes(std::nullopt, head, apply_to_next);
+    }
+    if (!current) {
+        size_t paths = 0;
+        for (const auto& shard : next->shards) {
+            paths += shard ? shard->size() : 0;
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        fmt::print("last modified: indexed {} paths in {}\n", paths, elapsed);
+    }
+
+    std::atomic_store(&table, std::shared_ptr<const Table>{std::move(next)});
+}
+
+void LastModifiedIndex::apply(Table& table, std::vector<bool>& copied, const Oid& commit, s64 time, const std::vector<Repository::PathChange>& changes)
+{
+    table.head = commit;
+    if (changes.empty()) {
+        return;
+    }
+
+    const auto shard = [&](std::string_view path) -> Table::Shard& {
+        const size_t index = Table::shard_of(path);
+        auto& slot = table.shards[index];
+        if (!copied[index]) {
+            slot = slot ? std::make_shared<Table::Shard>(*slot) : std::make_shared<Table::Shard>();
+            copied[index] = true;
+        }
+        return *slot;
+    };
+
+    const Change change{commit, time};
+    for (const auto& [path, deleted] : changes) {
+        if (deleted) {
+            shard(path).erase(path);
+        } else {
+            shard(path).insert_or_assign(path, change);
+        }
+
+        // Every directory above a changed file changed with it, up to and including the root.
+        std::string_view dir = path;
+        while (!dir.empty()) {
+            const size_t slash = dir.rfind('/');
+            dir = slash == std::string_view::npos ? std::string_view{} : dir.substr(0, slash);
+            shard(dir).insert_or_assign(std::string{dir}, change);
+        }
+    }
+}
+
+}  // namespace libellus
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <mcl/stdint.hpp>
+
+#include "repository.hpp"
+
+namespace libellus {
+
+/// The commit that last changed each path along the first-parent history of a ref, so that a listing can say when
+/// each entry changed without a revwalk per entry. A thread of its own builds it over the whole history at startup,
+/// then brings it forward one commit at a time from their tree diffs as the ref moves, publishing each table whole.
+/// Readers never wait for it. Safe to share between threads.
+class LastModifiedIndex {
+public:
+    struct Change {
+        Oid commit;
+        s64 time;  // Committer time, in seconds since the epoch
+    };
+
+    /// Every path as of one commit. Directories are included, and the root directory has an empty path. Immutable
+    /// once published.
+    class Table {
+    public:
+        const Oid& commit() const { return head; }
+        /// `path` has no leading or trailing slashes.
+        const Change* find(std::string_view path) const;
+
+    private:
+        friend class LastModifiedIndex;
+
+        struct Hash {
+            using is_transparent = void;
+            size_t operator()(std::string_view path) const { return std::hash<std::string_view>{}(path); }
+        };
+        using Shard = std::unordered_map<std::string, Change, Hash, std::equal_to<>>;
+
+        /// Paths are spread over shards so that the next table shares every shard a commit left alone with this one,
+        /// and only the few it touched are copied.
+        static constexpr size_t shard_count = 1024;
+        static size_t shard_of(std::string_view path) { return Hash{}(path) % shard_count; }
+
+        Oid head;
+        std::array<std::shared_ptr<Shard>, shard_count> shards;  // Null for a shard without paths
+    };
+
+    LastModifiedIndex(const std::string& repo_path, std::string_view refname);
+    ~LastModifiedIndex();
+
+    LastModifiedIndex(const LastModifiedIndex&) = delete;
+    LastModifiedIndex& operator=(const LastModifiedIndex&) = delete;
+
+    /// The table as of `commit`, or null if the index is not there. For the current head of the ref, that only
+    /// lasts until the indexing thread, which this wakes, has caught up. Any other commit, such as that of a snapshot
+    /// taken before the ref last moved, always gets null.
+    std::shared_ptr<const Table> at(const Oid& commit);
+
+private:
+    void run();
+    /// Publishes a table for the current head of the ref, if the published one is not for it already.
+    void catch_up();
+    /// Brings `table` forward by one commit. The shards marked in `copied` belong to `table` alone; any other is
+    /// shared with a published table, and is copied before it is first changed.
+    static void apply(Table& table, std::vector<bool>& copied, const Oid& commit, s64 time, const std::vector<Repository::PathChange>& changes);
+
+    Repository repo;  // Only used by the indexing thread
+    /// Null until the first build is done. Only accessed through std::atomic_load and std::atomic_store, as
+    /// std::atomic<std::shared_ptr> is missing from some standard libraries.
+    std::shared_ptr<const Table> table;
+
+    std::mutex mutex;  // Guards the flags below
+    std::condition_variable wake;
+    bool requested = false;
+    bool stopping = false;
+
+    std::thread thread;
+};
+
+}  // namespace libellus
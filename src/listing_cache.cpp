@@ -0,0 +1,71 @@
+#include "listing_cache.hpp"
+
+#include <cstring>
+#include <functional>
+
+namespace libellus {
+
+size_t ListingCache::KeyHash::operator()(const Key& key) const
+{
+    // Object ids are already uniformly distributed.
+    size_t result;
+    std::memcpy(&result, key.tree.oid.data(), sizeof(result));
+    if (key.last_change) {
+        size_t last_change;
+        std::memcpy(&last_change, key.last_change->oid.data(), sizeof(last_change));
+        result ^= last_change ^ std::hash<std::string>{}(key.dir_path);
+    }
+    return result ^ key.renderer_version;
+}
+
+ListingCache::Key ListingCache::make_key(const Oid& tree, const std::optional<Oid>& last_change, std::string_view dir_path, u32 renderer_version)
+{
+    // Without dates, a listing is the same wherever its tree is.
+    return Key{tree, last_change, last_change ? std::string{dir_path} : std::string{}, renderer_version};
+}
+
+ListingCache::ListingCache(size_t capacity_bytes)
+    : capacity_bytes(capacity_bytes)
+{}
+
+std::shared_ptr<const std::string> ListingCache::find(const Oid& tree, const std::optional<Oid>& last_change, std::string_view dir_path, u32 renderer_version)
+{
+    const Key key = make_key(tree, last_change, dir_path, renderer_version);
+
+    std::lock_guard lock{mutex};
+
+    const auto iter = index.find(key);
+    if (iter == index.end()) {
+        return nullptr;
+    }
+
+    entries.splice(entries.begin(), entries, iter->second);
+    return iter->second->html;
+}
+
+void ListingCache::insert(const Oid& tree, const std::optional<Oid>& last_change, std::string_view dir_path, u32 renderer_version, std::shared_ptr<const std::string> html)
+{
+    if (html->size() > capacity_bytes) {
+        return;
+    }
+
+    const Key key = make_key(tree, last_change, dir_path, renderer_version);
+
+    std::lock_guard lock{mutex};
+
+    if (index.contains(key)) {
+        return;
+    }
+
+    size_bytes += html->size();
+    entries.emplace_front(Entry{key, std::move(html)});
+    index.emplace(key, entries.begin());
+
+    while (size_bytes > capacity_bytes) {
+        size_bytes -= entries.back().html->size();
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+}  // namespace libellus
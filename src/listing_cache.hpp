@@ -0,0 +1,60 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <mcl/stdint.hpp>
+
+#include "repository.hpp"
+
+namespace libellus {
+
+/// Rendered directory listings, keyed by tree Oid and the version of the renderer that produced them.
+/// As trees are content-addressed an entry never goes stale; the cache is bounded by the total size
+/// of its entries and evicts the least recently used first. Safe to share between threads.
+///
+/// Listings that show when each entry last changed also depend on history, so they are further keyed
+/// by the commit that last changed the directory, and by its path, as the same tree can be at several
+/// paths whose entries changed at different times.
+class ListingCache {
+public:
+    explicit ListingCache(size_t capacity_bytes);
+
+    /// `dir_path` is only part of the key with a `last_change`.
+    std::shared_ptr<const std::string> find(const Oid& tree, const std::optional<Oid>& last_change, std::string_view dir_path, u32 renderer_version);
+    void insert(const Oid& tree, const std::optional<Oid>& last_change, std::string_view dir_path, u32 renderer_version, std::shared_ptr<const std::string> html);
+
+private:
+    struct Key {
+        Oid tree;
+        std::optional<Oid> last_change;
+        std::string dir_path;  // Empty without a last_change
+        u32 renderer_version;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    static Key make_key(const Oid& tree, const std::optional<Oid>& last_change, std::string_view dir_path, u32 renderer_version);
+
+    struct Entry {
+        Key key;
+        std::shared_ptr<const std::string> html;
+    };
+
+    std::mutex mutex;
+    size_t capacity_bytes;
+    size_t size_bytes = 0;
+    std::list<Entry> entries;  // Most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+};
+
+}  // namespace libellus
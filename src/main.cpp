@@ -1,5 +1,18 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <ctime>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #include <boost/asio/dispatch.hpp>
 #include <boost/asio/spawn.hpp>
@@ -8,13 +21,25 @@
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/config.hpp>
+#include <fmt/chrono.h>
 #include <fmt/format.h>
 #include <fmt/ostream.h>
 #include <mcl/assert.hpp>
 #include <mcl/stdint.hpp>
 
+#include "commit_log.hpp"
+#include "commit_scheduler.hpp"
+#include "config.hpp"
+#include "import.hpp"
+#include "last_modified.hpp"
+#include "listing_cache.hpp"
+#include "maintenance.hpp"
+#include "path_history.hpp"
 #include "repository.hpp"
+#include "repository_pool.hpp"
 #include "resources/static/static_resources.hpp"
+#include "shared_body.hpp"
+#include "tree_walker.hpp"
 
 namespace beast = boost::beast;    // from <boost/beast.hpp>
 namespace http = beast::http;      // from <boost/beast/http.hpp>
@@ -84,9 +109,252 @@ beast::string_view mime_type(beast::string_view path)
     return "application/octet-stream";
 }
 
-template<typename SendLambda>
-void handle_request(http::request<http::string_body> req, SendLambda send, net::yield_context yield)
+// Whether `coding` is acceptable according to the value of an Accept-Encoding header.
+bool accepts_encoding(beast::string_view accept_encoding, beast::string_view coding)
 {
+    std::optional<bool> wildcard;
+    for (const auto& [token, params] : http::ext_list{accept_encoding}) {
+        const bool is_coding = beast::iequals(token, coding);
+        if (!is_coding && token != "*")
+            continue;
+
+        bool acceptable = true;
+        for (const auto& [name, value] : params) {
+            if (beast::iequals(name, "q"))
+                acceptable = value.find_first_not_of("0.") != beast::string_view::npos;
+        }
+
+        if (is_coding)
+            return acceptable;
+        wildcard = acceptable;
+    }
+    return wildcard.value_or(false);
+}
+
+// Whether any entity tag in the value of an If-None-Match header matches `etag`, using the weak comparison function.
+bool etag_matches(beast::string_view if_none_match, beast::string_view etag)
+{
+    const auto opaque_tag = [](beast::string_view tag) {
+        if (tag.starts_with("W/"))
+            tag.remove_prefix(2);
+        return tag;
+    };
+
+    while (!if_none_match.empty()) {
+        const auto comma = if_none_match.find(',');
+        auto tag = if_none_match.substr(0, comma);
+        if_none_match = comma == beast::string_view::npos ? beast::string_view{} : if_none_match.substr(comma + 1);
+
+        tag.remove_prefix(std::min(tag.find_first_not_of(" \t"), tag.size()));
+        tag.remove_suffix(tag.size() - std::min(tag.find_last_not_of(" \t") + 1, tag.size()));
+
+        if (tag == "*" || opaque_tag(tag) == opaque_tag(etag))
+            return true;
+    }
+    return false;
+}
+
+// The value of the first `name` parameter in the query string of `target`: empty if it has no value, as in "?files",
+// and nullopt if it is absent.
+std::optional<beast::string_view> query_parameter(beast::string_view target, beast::string_view name)
+{
+    const auto question = target.find('?');
+    if (question == beast::string_view::npos) {
+        return std::nullopt;
+    }
+
+    auto query = target.substr(question + 1);
+    while (!query.empty()) {
+        const auto ampersand = query.find('&');
+        const auto parameter = query.substr(0, ampersand);
+        query = ampersand == beast::string_view::npos ? beast::string_view{} : query.substr(ampersand + 1);
+
+        const auto equals = parameter.find('=');
+        if (parameter.substr(0, equals) == name) {
+            return equals == beast::string_view::npos ? beast::string_view{} : parameter.substr(equals + 1);
+        }
+    }
+    return std::nullopt;
+}
+
+// For text in an element or a double-quoted attribute. Commit messages, authors and file names are all arbitrary text.
+void append_escaped_html(std::string& out, std::string_view text)
+{
+    for (const char c : text) {
+        switch (c) {
+        case '&':
+            out += "&amp;";
+            break;
+        case '<':
+            out += "&lt;";
+            break;
+        case '>':
+            out += "&gt;";
+            break;
+        case '"':
+            out += "&quot;";
+            break;
+        default:
+            out += c;
+            break;
+        }
+    }
+}
+
+// For a path segment in a relative link: every byte other than an unreserved character is escaped, so that a name
+// cannot end the attribute, nor be read as a scheme, query or fragment.
+void append_percent_encoded(std::string& out, std::string_view segment)
+{
+    for (const char c : segment) {
+        if (std::isalnum((unsigned char)c) || c == '-' || c == '.' || c == '_' || c == '~') {
+            out += c;
+        } else {
+            fmt::format_to(std::back_inserter(out), "%{:02X}", (unsigned char)c);
+        }
+    }
+}
+
+// `time`, in seconds since the epoch, broken down in UTC. Nullopt if it is out of range, as a commit can claim any
+// time at all.
+std::optional<std::tm> utc_time(s64 time)
+{
+    std::tm result;
+    if (time < std::numeric_limits<std::time_t>::min() || time > std::numeric_limits<std::time_t>::max()) {
+        return std::nullopt;
+    }
+    const std::time_t t = (std::time_t)time;
+    if (!gmtime_r(&t, &result)) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+// One commit as an item in a list of changes.
+void append_commit_item(std::string& out, const libellus::Repository::CommitInfo& commit)
+{
+    out += "<li>";
+    if (const auto time = utc_time(commit.author_time)) {
+        fmt::format_to(std::back_inserter(out), R"(<time datetime="{:%Y-%m-%dT%H:%M:%SZ}">{:%Y-%m-%d %H:%M}</time> )", *time, *time);
+    }
+    fmt::format_to(std::back_inserter(out), "<code>{}</code> ", commit.oid.to_string().substr(0, 12));
+    append_escaped_html(out, commit.summary);
+    out += " &mdash; ";
+    append_escaped_html(out, commit.author);
+    out += "</li>";
+}
+
+constexpr size_t changes_per_page = 50;
+
+// The number of newer entries a page of a paged list skips, from the skip parameter of `target`: zero without one,
+// nullopt if it is not a number. Clamped so that the skip of the next page cannot wrap; a skip that large is past
+// the end of any history anyway.
+std::optional<size_t> page_skip(std::string_view target)
+{
+    const auto parameter = query_parameter(target, "skip");
+    if (!parameter) {
+        return 0;
+    }
+    const auto parsed = libellus::parse_number<size_t>(*parameter);
+    if (!parsed) {
+        return std::nullopt;
+    }
+    return std::min(*parsed, std::numeric_limits<size_t>::max() - changes_per_page);
+}
+
+// Bump whenever the HTML generated for a directory listing changes, so stale ETags and cache entries stop matching.
+constexpr u32 listing_renderer_version = 3;
+
+// A response serialized ahead of time, sent with a single gathered write.
+struct PreparedResponse {
+    bool keep_alive;
+    std::array<net::const_buffer, 5> buffers;
+};
+
+struct Worker {
+    explicit Worker(libellus::Repository& repo, libellus::ListingCache& listing_cache, libellus::CommitScheduler& commit_scheduler, libellus::LastModifiedIndex* last_modified, libellus::CommitLog* commit_log,
+                    libellus::PathHistory* path_history, libellus::TreeWalker* tree_walker, u64 upload_limit)
+        : repo(repo), listing_cache(listing_cache), commit_scheduler(commit_scheduler), last_modified(last_modified), commit_log(commit_log), path_history(path_history), tree_walker(tree_walker), upload_limit(upload_limit) {}
+
+    net::io_context ioc{1};
+    libellus::Repository& repo;
+    libellus::ListingCache& listing_cache;
+    libellus::CommitScheduler& commit_scheduler;
+    libellus::LastModifiedIndex* last_modified;  // Null unless enabled
+    libellus::CommitLog* commit_log;  // Null unless enabled
+    libellus::PathHistory* path_history;  // Null unless enabled
+    libellus::TreeWalker* tree_walker;  // Null unless enabled
+    u64 upload_limit;  // Zero for no limit
+};
+
+bool is_upload(http::verb method)
+{
+    return method == http::verb::put || method == http::verb::post;
+}
+
+// Decodes %XX escapes in the path of a request target. Returns nullopt for a malformed escape.
+std::optional<std::string> percent_decode(std::string_view path)
+{
+    const auto hex_value = [](char c) -> int {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    };
+
+    std::string result;
+    result.reserve(path.size());
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (path[i] != '%') {
+            result += path[i];
+            continue;
+        }
+        if (i + 2 >= path.size() || hex_value(path[i + 1]) < 0 || hex_value(path[i + 2]) < 0) {
+            return std::nullopt;
+        }
+        result += (char)(hex_value(path[i + 1]) * 16 + hex_value(path[i + 2]));
+        i += 2;
+    }
+    return result;
+}
+
+// Streams the body of an upload into a new blob as it arrives, so that it is never held in memory as a whole.
+// Returns nullopt with `ec` set if the connection fails or the body exceeds its limit first, in which case the
+// partial blob is discarded.
+std::optional<libellus::Oid> read_upload(beast::tcp_stream& stream, beast::flat_buffer& buf, http::request_parser<http::buffer_body>& parser, libellus::Repository& repo, beast::error_code& ec,
+                                         net::yield_context yield)
+{
+    libellus::BlobWriter blob = repo.write_blob();
+
+    std::array<char, 64 * 1024> chunk;
+    auto& body = parser.get().body();
+    while (!parser.is_done()) {
+        body.data = chunk.data();
+        body.size = chunk.size();
+        http::async_read(stream, buf, parser, yield[ec]);
+
+        // Only means that the chunk is full.
+        if (ec == http::error::need_buffer)
+            ec = {};
+        if (ec) {
+            fmt::print("session::read_upload error: {}\n", ec.message());
+            return std::nullopt;
+        }
+
+        blob.write({chunk.data(), chunk.size() - body.size});
+    }
+
+    return std::move(blob).finish();
+}
+
+// The body of an upload has already been written to the blob `upload`; no other request has a body that matters.
+template<typename Body, typename SendLambda>
+void handle_request(const http::request<Body>& req, std::optional<libellus::Oid> upload, Worker& worker, SendLambda send, net::yield_context yield)
+{
+    auto& repo = worker.repo;
+
     const auto string_response = [&req](http::status status, beast::string_view content_type, std::string_view body) {
         http::response<http::string_body> res{status, req.version()};
         res.set(http::field::content_type, content_type);
@@ -96,58 +364,284 @@ void handle_request(http::request<http::string_body> req, SendLambda send, net::
         return res;
     };
 
+    // Frames header fields and a body that were serialized ahead of time; nothing is copied.
+    const auto prepared_response = [&req](http::status status, std::string_view headers, std::span<const unsigned char> body) {
+        ASSERT(status == http::status::ok || status == http::status::not_modified);
+        const std::string_view status_line = status == http::status::ok ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.1 304 Not Modified\r\n";
+        const std::string_view connection = !req.keep_alive() ? "Connection: close\r\n" : req.version() < 11 ? "Connection: keep-alive\r\n" : "";
+        return PreparedResponse{
+            .keep_alive = req.keep_alive(),
+            .buffers = {net::buffer(status_line), net::buffer(headers), net::buffer(connection), net::buffer("\r\n", 2), net::buffer(body.data(), body.size())},
+        };
+    };
+
+    const auto not_modified_response = [&req](beast::string_view etag) {
+        http::response<http::empty_body> res{http::status::not_modified, req.version()};
+        res.set(http::field::etag, etag);
+        res.keep_alive(req.keep_alive());
+        return res;
+    };
+
+    // Every route works with the path of the target decoded and without its query, so that a file is read back by
+    // the same URL it was written to.
+    const auto decoded_path = percent_decode(req.target().substr(0, req.target().find('?')));
+    if (!decoded_path) {
+        return send(string_response(http::status::bad_request, "text/plain", "invalid path"));
+    }
+    const std::string& target_path = *decoded_path;
+
+    if (is_upload(req.method())) {
+        ASSERT(upload);
+
+        // Checked here so that a bad path is the client's error, rather than a failed commit.
+        std::string path = target_path;
+        path.erase(0, path.find_first_not_of('/'));
+        if (!libellus::is_valid_path(path)) {
+            return send(string_response(http::status::bad_request, "text/plain", "invalid path"));
+        }
+
+        libellus::WriteRequest write{
+            .message = fmt::format("Update {}", path),
+            .changes = {{.kind = libellus::Change::Kind::UpsertBlob, .path = std::move(path), .data = {}, .blob = *upload}},
+        };
+
+        if (worker.commit_scheduler.journaled()) {
+            // Suspends only until the write is durable in the journal; it is committed in the background.
+            const auto sequence = worker.commit_scheduler.async_journal(std::move(write), yield);
+            return send(string_response(http::status::accepted, "text/plain", fmt::format("{}", sequence)));
+        }
+
+        // Suspends until the scheduler has committed this write, possibly along with others.
+        const auto commit = worker.commit_scheduler.async_commit(std::move(write), yield);
+        if (!commit) {
+            const auto status = commit.error().kind == libellus::CommitError::Kind::Conflict ? http::status::conflict : http::status::bad_request;
+            return send(string_response(status, "text/plain", commit.error().message));
+        }
+        return send(string_response(http::status::ok, "text/plain", commit->to_string()));
+    }
+
     if (req.method() != http::verb::get) {
         return send(string_response(http::status::bad_request, "text/plain", "Unknown HTTP method"));
     }
 
-    if (req.target().starts_with("/static/")) {
-        const auto& static_map = libellus::resources::static_resources_map;
-        const auto map_key = "resources" + std::string{req.target()};
-        if (auto iter = static_map.find(map_key); iter != static_map.end()) {
-            return send(string_response(http::status::ok, mime_type(map_key), std::string_view{(const char*)iter->second.data(), iter->second.size()}));
+    if (target_path.starts_with("/static/")) {
+        if (const auto* resource_ptr = libellus::resources::static_resources_lookup(target_path)) {
+            const auto& resource = *resource_ptr;
+            const auto accept_encoding = req[http::field::accept_encoding];
+
+            const libellus::resources::Variant* variant = &resource.identity;
+            for (const auto& [coding, candidate] : {std::pair{"br", &resource.brotli}, std::pair{"gzip", &resource.gzip}}) {
+                if (!candidate->data.empty() && candidate->data.size() < variant->data.size() && accepts_encoding(accept_encoding, coding)) {
+                    variant = candidate;
+                }
+            }
+
+            if (etag_matches(req[http::field::if_none_match], variant->etag)) {
+                return send(prepared_response(http::status::not_modified, variant->not_modified_headers, {}));
+            }
+            return send(prepared_response(http::status::ok, variant->headers, variant->data));
         }
         return send(string_response(http::status::not_found, "text/plain", "static file not found"));
     }
 
-    libellus::Repository repo{"/Users/merry/Workspace/libellus", "refs/heads/main"};
-    const auto files = repo.list(std::string{req.target()});
+    if (worker.commit_log && target_path == "/changes") {
+        // Pages are addressed by how many newer commits they skip, so that a page as of some time lines up with its neighbours.
+        size_t skip = 0;
+        if (const auto as_of = query_parameter(req.target(), "as-of")) {
+            const auto time = libellus::parse_number<s64>(*as_of);
+            if (!time) {
+                return send(string_response(http::status::bad_request, "text/plain", "as-of must be in seconds since the epoch"));
+            }
+            skip = worker.commit_log->skip_to(*time);
+        } else if (const auto parsed = page_skip(req.target())) {
+            skip = *parsed;
+        } else {
+            return send(string_response(http::status::bad_request, "text/plain", "skip must be a number"));
+        }
+
+        // One more than fits on the page tells whether there is an older page.
+        const auto commits = worker.commit_log->recent(skip, changes_per_page + 1);
+
+        std::string result = "<ul>";
+        for (size_t i = 0; i < std::min(commits.size(), changes_per_page); ++i) {
+            append_commit_item(result, commits[i]);
+        }
+        result += "</ul>";
+        if (skip != 0) {
+            fmt::format_to(std::back_inserter(result), R"(<a href="/changes?skip={}">Newer</a> )", skip - std::min(skip, changes_per_page));
+        }
+        if (commits.size() > changes_per_page) {
+            fmt::format_to(std::back_inserter(result), R"(<a href="/changes?skip={}">Older</a>)", skip + changes_per_page);
+        }
+
+        return send(string_response(http::status::ok, "text/html", result));
+    }
+
+    if (worker.path_history && query_parameter(req.target(), "history")) {
+        const auto skip_parameter = page_skip(req.target());
+        if (!skip_parameter) {
+            return send(string_response(http::status::bad_request, "text/plain", "skip must be a number"));
+        }
+        const size_t skip = *skip_parameter;
+
+        // Walked off this worker, which goes on serving other sessions meanwhile. Changed-path filters let the walk
+        // pass over most commits that left the path alone without reading their trees.
+        const auto page = worker.path_history->async_page(target_path, skip, changes_per_page, yield);
+
+        std::string result = "<ul>";
+        for (const auto& commit : page.commits) {
+            append_commit_item(result, commit);
+        }
+        result += "</ul>";
+        if (skip != 0) {
+            fmt::format_to(std::back_inserter(result), R"(<a href="?history&amp;skip={}">Newer</a> )", skip - std::min(skip, changes_per_page));
+        }
+        if (page.has_older) {
+            fmt::format_to(std::back_inserter(result), R"(<a href="?history&amp;skip={}">Older</a>)", skip + changes_per_page);
+        }
 
-    if (!files) {
+        return send(string_response(http::status::ok, "text/html", result));
+    }
+
+    if (worker.tree_walker && query_parameter(req.target(), "files")) {
+        // Walked off this worker, which goes on serving other sessions until the listing is complete.
+        std::mutex mutex;
+        std::vector<std::pair<std::string, libellus::Oid>> files;
+        const libellus::TreeWalker::Visitor visitor = [&](std::string_view path, const libellus::TreeView::Entry& entry) {
+            if (entry.is_blob) {
+                std::lock_guard lock{mutex};
+                files.emplace_back(path, entry.oid);
+            }
+        };
+        if (!worker.tree_walker->async_walk(target_path, visitor, yield)) {
+            return send(string_response(http::status::not_found, "text/plain", "not a directory"));
+        }
+
+        // The walk visits entries in no particular order; sorting by path makes the response stable.
+        std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::string result;
+        for (const auto& [path, oid] : files) {
+            fmt::format_to(std::back_inserter(result), "{} {}\n", oid.to_string(), path);
+        }
+        return send(string_response(http::status::ok, "text/plain", result));
+    }
+
+    const auto snapshot = repo.snapshot();
+    const auto dir = snapshot.stat(target_path);
+    if (!dir) {
         return send(string_response(http::status::ok, "text/plain", "not found"));
     }
 
-    std::string result = R"(<ul><li><a href="..">..</a></li>)";
-    for (auto& f : *files) {
-        result += "<li>";
-        result += fmt::format(R"(<a href="{0}/">{0}</a>)", f.name);
-        result += "</li>";
+    if (dir->is_blob) {
+        // Blobs are content-addressed too, and are sent straight out of the object database.
+        const auto etag = fmt::format("\"{}\"", dir->oid.to_string());
+        if (etag_matches(req[http::field::if_none_match], etag)) {
+            return send(not_modified_response(etag));
+        }
+
+        http::response<libellus::SharedBody<libellus::BlobView>> res{http::status::ok, req.version()};
+        res.set(http::field::content_type, mime_type(target_path));
+        res.set(http::field::etag, etag);
+        res.keep_alive(req.keep_alive());
+        res.body() = std::make_shared<const libellus::BlobView>(repo.read(dir->oid));
+        res.prepare_payload();
+        return send(std::move(res));
+    }
+
+    // Dates are only shown once the last-modified index has caught up with this snapshot.
+    std::string dir_path = target_path;
+    dir_path.erase(0, dir_path.find_first_not_of('/'));
+    dir_path.erase(dir_path.find_last_not_of('/') + 1);
+
+    const auto last_modified = worker.last_modified && snapshot.commit() ? worker.last_modified->at(*snapshot.commit()) : nullptr;
+    const auto* dir_change = last_modified ? last_modified->find(dir_path) : nullptr;
+    const auto last_change = dir_change ? std::optional{dir_change->commit} : std::nullopt;
+
+    // Trees are content-addressed, so the listing of a tree never changes for a given renderer. With dates, it also
+    // depends on history, which is settled by the commit that last changed the directory.
+    const auto etag = last_change ? fmt::format("\"{}-{}-{}\"", listing_renderer_version, dir->oid.to_string(), last_change->to_string())
+                                  : fmt::format("\"{}-{}\"", listing_renderer_version, dir->oid.to_string());
+    if (etag_matches(req[http::field::if_none_match], etag)) {
+        return send(not_modified_response(etag));
+    }
+
+    auto html = worker.listing_cache.find(dir->oid, last_change, dir_path, listing_renderer_version);
+    if (!html) {
+        std::string result = R"(<ul><li><a href="..">..</a></li>)";
+        std::string path = dir_path.empty() ? "" : dir_path + "/";
+        for (const auto& f : repo.list(dir->oid)) {
+            // Only directories get a trailing slash, so that relative links from within them resolve.
+            result += R"(<li><a href=")";
+            append_percent_encoded(result, f.name);
+            result += f.is_tree ? R"(/">)" : R"(">)";
+            append_escaped_html(result, f.name);
+            result += "</a>";
+
+            path.resize(dir_path.empty() ? 0 : dir_path.size() + 1);
+            path += f.name;
+            if (const auto* change = last_change ? last_modified->find(path) : nullptr) {
+                if (const auto time = utc_time(change->time)) {
+                    fmt::format_to(std::back_inserter(result), R"( <time datetime="{:%Y-%m-%dT%H:%M:%SZ}">{:%Y-%m-%d}</time>)", *time, *time);
+                }
+            }
+
+            result += "</li>";
+        }
+        result += "</ul>";
+
+        html = std::make_shared<const std::string>(std::move(result));
+        worker.listing_cache.insert(dir->oid, last_change, dir_path, listing_renderer_version, html);
     }
-    result += "</ul>";
 
-    return send(string_response(http::status::ok, "text/html", result));
+    http::response<libellus::SharedBody<std::string>> res{http::status::ok, req.version()};
+    res.set(http::field::content_type, "text/html");
+    res.set(http::field::etag, etag);
+    res.keep_alive(req.keep_alive());
+    res.body() = std::move(html);
+    res.prepare_payload();
+    return send(std::move(res));
 }
 
-void do_session(net::io_context& ioc, beast::tcp_stream stream, net::yield_context yield)
+void do_session(Worker& worker, beast::tcp_stream stream, net::yield_context yield)
 {
     beast::error_code ec;
 
     beast::flat_buffer buf;
-    http::request<http::string_body> req;
     bool close = false;
 
     const auto send_lambda = [&]<typename Msg>(Msg&& msg) {
-        close = msg.need_eof();
+        if constexpr (std::is_same_v<std::decay_t<Msg>, PreparedResponse>) {
+            close = !msg.keep_alive;
 
-        using is_request = typename Msg::is_request;
-        using body_type = typename Msg::body_type;
-        using fields_type = typename Msg::fields_type;
-        http::serializer<is_request::value, body_type, fields_type> ser{msg};
+            net::async_write(stream, msg.buffers, yield[ec]);
+        } else {
+            close = msg.need_eof();
 
-        http::async_write(stream, ser, yield[ec]);
+            using is_request = typename Msg::is_request;
+            using body_type = typename Msg::body_type;
+            using fields_type = typename Msg::fields_type;
+            http::serializer<is_request::value, body_type, fields_type> ser{msg};
+
+            http::async_write(stream, ser, yield[ec]);
+        }
+    };
+
+    // Refuses an upload before its body is read. The unread body leaves the connection unusable, so it is closed.
+    const auto reject_upload = [&](const http::request_header<>& req, http::status status, std::string_view reason) {
+        http::response<http::string_body> res{status, req.version()};
+        res.set(http::field::content_type, "text/plain");
+        res.keep_alive(false);
+        res.body() = std::string{reason};
+        res.prepare_payload();
+        send_lambda(std::move(res));
     };
 
     for (;;) {
-        http::async_read(stream, buf, req, yield[ec]);
+        // The header is read on its own, so that the body can be read in the way the method needs. Its size limit
+        // depends on the method too, so it is applied once the header is in.
+        http::request_parser<http::empty_body> header_parser;
+        header_parser.body_limit(boost::none);
+        http::async_read_header(stream, buf, header_parser, yield[ec]);
 
         if (ec == http::error::end_of_stream)
             break;
@@ -157,7 +651,48 @@ void do_session(net::io_context& ioc, beast::tcp_stream stream, net::yield_conte
             break;
         }
 
-        handle_request(req, send_lambda, yield);
+        if (is_upload(header_parser.get().method())) {
+            http::request_parser<http::buffer_body> parser{std::move(header_parser)};
+            // The body goes straight to disk, so its size is not limited by memory, only by configuration.
+            parser.body_limit(worker.upload_limit ? boost::optional<std::uint64_t>{worker.upload_limit} : boost::none);
+
+            // A chunked body is checked against the limit as it arrives instead.
+            if (worker.upload_limit && parser.content_length() && *parser.content_length() > worker.upload_limit) {
+                reject_upload(parser.get(), http::status::payload_too_large, "upload too large");
+                break;
+            }
+
+            // A client that asked to wait sends the body only once told that it will be read.
+            if (beast::iequals(parser.get()[http::field::expect], "100-continue")) {
+                http::response<http::empty_body> res{http::status::continue_, parser.get().version()};
+                http::async_write(stream, res, yield[ec]);
+                if (ec) {
+                    fmt::print("session::do_write error: {}\n", ec.message());
+                    break;
+                }
+            }
+
+            const auto upload = read_upload(stream, buf, parser, worker.repo, ec, yield);
+            if (!upload) {
+                if (ec == http::error::body_limit)
+                    reject_upload(parser.get(), http::status::payload_too_large, "upload too large");
+                break;
+            }
+
+            handle_request(parser.get(), upload, worker, send_lambda, yield);
+        } else {
+            http::request_parser<http::string_body> parser{std::move(header_parser)};
+            // Beast's default for requests, as these bodies are read into memory.
+            parser.body_limit(1024 * 1024);
+            http::async_read(stream, buf, parser, yield[ec]);
+
+            if (ec) {
+                fmt::print("session::do_read error: {}\n", ec.message());
+                break;
+            }
+
+            handle_request(parser.get(), std::nullopt, worker, send_lambda, yield);
+        }
 
         ASSERT_MSG(!ec, "write failure {}", ec.message());
 
@@ -169,12 +704,16 @@ void do_session(net::io_context& ioc, beast::tcp_stream stream, net::yield_conte
     ASSERT_MSG(!ec, "session::do_close {}", ec.message());
 }
 
-void do_listen(net::io_context& ioc, net::ip::address addr, u16 port, net::yield_context yield)
+#if defined(SO_REUSEPORT)
+using reuse_port = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+// Accepts connections on `worker` and spawns each session on the next of `session_workers` in turn.
+void do_listen(Worker& worker, std::vector<Worker*> session_workers, tcp::endpoint endpoint, net::yield_context yield)
 {
     beast::error_code ec;
 
-    tcp::endpoint endpoint{addr, port};
-    tcp::acceptor acceptor{ioc};
+    tcp::acceptor acceptor{worker.ioc};
 
     acceptor.open(endpoint.protocol(), ec);
     ASSERT_MSG(!ec, "acceptor.open {}", ec.message());
@@ -182,36 +721,104 @@ void do_listen(net::io_context& ioc, net::ip::address addr, u16 port, net::yield
     acceptor.set_option(net::socket_base::reuse_address(true), ec);
     ASSERT_MSG(!ec, "acceptor.set_option {}", ec.message());
 
+#if defined(SO_REUSEPORT)
+    acceptor.set_option(reuse_port(true), ec);
+    ASSERT_MSG(!ec, "acceptor.set_option {}", ec.message());
+#endif
+
     acceptor.bind(endpoint, ec);
     ASSERT_MSG(!ec, "acceptor.bind {}", ec.message());
 
     acceptor.listen(net::socket_base::max_listen_connections, ec);
     ASSERT_MSG(!ec, "acceptor.listen {}", ec.message());
 
-    for (;;) {
-        tcp::socket socket{ioc};
+    for (size_t next = 0;; next = (next + 1) % session_workers.size()) {
+        Worker& session_worker = *session_workers[next];
+
+        tcp::socket socket{session_worker.ioc};
 
         acceptor.async_accept(socket, yield[ec]);
         ASSERT_MSG(!ec, "accept failure {}", ec.message());
 
-        boost::asio::spawn(ioc, [&](net::yield_context yield) {
-            do_session(ioc, beast::tcp_stream{std::move(socket)}, yield);
+        boost::asio::spawn(session_worker.ioc, [&session_worker, socket = std::move(socket)](net::yield_context yield) mutable {
+            do_session(session_worker, beast::tcp_stream{std::move(socket)}, yield);
         });
     }
 }
 
-int main()
+int main(int argc, char** argv)
 {
-    const auto addr = net::ip::make_address("0.0.0.0");
-    const u16 port = 54321;
+    const auto config = libellus::parse_config(argc, argv);
+    if (!config.import_source.empty()) {
+        return libellus::run_import(config, config.import_source);
+    }
+
+    if (!config.journal_path.empty()) {
+        // A journaled upload is acknowledged before its commit, so the blob it names must already be on disk.
+        libellus::enable_fsync();
+    }
+
+    const tcp::endpoint endpoint{net::ip::make_address(config.address), config.port};
+
+    // Repositories are opened once up front; each worker gets its own handle as libgit2 handles are not thread-safe.
+    libellus::RepositoryPool pool{config.repository_path, config.refname, config.threads, config.path_index};
+    libellus::ListingCache listing_cache{config.listing_cache_size};
+    std::optional<libellus::LastModifiedIndex> last_modified;
+    if (config.last_modified) {
+        last_modified.emplace(config.repository_path, config.refname);
+    }
+    std::optional<libellus::CommitLog> commit_log;
+    if (config.commit_log) {
+        commit_log.emplace(config.repository_path, config.refname);
+    }
+    std::optional<libellus::PathHistory> path_history;
+    if (config.history) {
+        path_history.emplace(config.repository_path, config.refname);
+    }
+    std::optional<libellus::TreeWalker> tree_walker;
+    if (config.file_manifest) {
+        tree_walker.emplace(config.repository_path, config.refname, config.threads);
+    }
+    std::optional<libellus::Maintenance> maintenance;
+    if (config.maintenance_interval != 0) {
+        maintenance.emplace(config.repository_path, config.refname, std::chrono::seconds{config.maintenance_interval}, libellus::Maintenance::Thresholds{});
+    }
+    libellus::CommitScheduler commit_scheduler{config.repository_path, config.refname, config.pack_writes, std::chrono::microseconds{config.commit_window}, config.commit_batch, config.journal_path};
 
-    net::io_context ioc{};
+    // One single-threaded io_context per worker, so sessions never need a strand.
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t i = 0; i < config.threads; ++i) {
+        workers.emplace_back(std::make_unique<Worker>(pool[i], listing_cache, commit_scheduler, last_modified ? &*last_modified : nullptr, commit_log ? &*commit_log : nullptr,
+                                                      path_history ? &*path_history : nullptr, tree_walker ? &*tree_walker : nullptr, config.upload_limit));
+    }
 
-    boost::asio::spawn(ioc, [&](net::yield_context yield) {
-        do_listen(ioc, addr, port, yield);
+#if defined(SO_REUSEPORT)
+    // Every worker has its own acceptor on the same port; the kernel balances incoming connections between them.
+    for (auto& worker : workers) {
+        boost::asio::spawn(worker->ioc, [&worker = *worker, endpoint](net::yield_context yield) {
+            do_listen(worker, {&worker}, endpoint, yield);
+        });
+    }
+#else
+    // Without SO_REUSEPORT a single acceptor hands connections out to the workers round-robin.
+    std::vector<Worker*> session_workers;
+    for (auto& worker : workers) {
+        session_workers.emplace_back(worker.get());
+    }
+    boost::asio::spawn(workers[0]->ioc, [&worker = *workers[0], session_workers, endpoint](net::yield_context yield) {
+        do_listen(worker, session_workers, endpoint, yield);
     });
+#endif
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers.size(); ++i) {
+        threads.emplace_back([&ioc = workers[i]->ioc] { ioc.run(); });
+    }
+    workers[0]->ioc.run();
 
-    ioc.run();
+    for (auto& thread : threads) {
+        thread.join();
+    }
 
     return 0;
 }
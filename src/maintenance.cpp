@@ -0,0 +1,70 @@
+#include "maintenance.hpp"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fmt/chrono.h>
+#include <fmt/format.h>
+
+namespace libellus {
+
+Maintenance::Maintenance(const std::string& repo_path, std::string_view refname, std::chrono::seconds interval, Thresholds thresholds)
+    : repo(repo_path, refname)
+    , interval(interval)
+    , thresholds(thresholds)
+{
+    thread = std::thread{[this] { run(); }};
+}
+
+Maintenance::~Maintenance()
+{
+    {
+        std::lock_guard lock{mutex};
+        stopping = true;
+    }
+    stop_requested.notify_one();
+    thread.join();
+}
+
+void Maintenance::run()
+{
+#if defined(__linux__)
+    // Linux applies nice values per thread, so this leaves the request threads alone.
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#endif
+
+    std::unique_lock lock{mutex};
+    while (!stop_requested.wait_for(lock, interval, [this] { return stopping; })) {
+        lock.unlock();
+        maintain();
+        lock.lock();
+    }
+}
+
+void Maintenance::maintain()
+{
+    // Cheap when little has been committed since the last run, so this does not wait for the thresholds.
+    const auto filters_start = std::chrono::steady_clock::now();
+    if (const size_t filtered = repo.write_changed_path_filters(); filtered != 0) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - filters_start);
+        fmt::print("maintenance: wrote changed-path filters for {} commits in {}\n", filtered, elapsed);
+    }
+
+    const auto stats = repo.object_stats(thresholds.grace_period);
+    if (stats.loose_objects < thresholds.loose_objects && stats.packs < thresholds.packs) {
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    const auto repacked = repo.repack(thresholds.grace_period);
+    repo.write_commit_graph();
+    repo.pack_refs();
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    fmt::print("maintenance: ~{} loose objects and {} packs; packed {} objects, removed {} packs and {} loose objects in {}\n",
+               stats.loose_objects, stats.packs, repacked.objects, repacked.removed_packs, repacked.removed_loose_objects, elapsed);
+}
+
+}  // namespace libellus
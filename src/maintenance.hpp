@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <mcl/stdint.hpp>
+
+#include "repository.hpp"
+
+namespace libellus {
+
+/// Keeps the repository that libellus writes into fast to read. A low-priority thread with its own handle wakes
+/// up every `interval`, and once there are too many loose objects or packs it repacks everything reachable into
+/// one pack, prunes what is left over, writes a commit-graph and packs refs. Changed-path filters for new commits
+/// are written on every wake-up. Readers are never blocked: the old packs stay valid for handles that have them
+/// open, and each step replaces files atomically.
+class Maintenance {
+public:
+    struct Thresholds {
+        size_t loose_objects = 1000;
+        size_t packs = 20;
+        /// Objects and packs younger than this are never removed, so writes in flight are not pruned.
+        std::chrono::seconds grace_period = std::chrono::hours{1};
+    };
+
+    Maintenance(const std::string& repo_path, std::string_view refname, std::chrono::seconds interval, Thresholds thresholds);
+    ~Maintenance();
+
+    Maintenance(const Maintenance&) = delete;
+    Maintenance& operator=(const Maintenance&) = delete;
+
+private:
+    void run();
+    void maintain();
+
+    Repository repo;
+    std::chrono::seconds interval;
+    Thresholds thresholds;
+
+    std::mutex mutex;
+    std::condition_variable stop_requested;
+    bool stopping = false;
+    std::thread thread;
+};
+
+}  // namespace libellus
@@ -0,0 +1,37 @@
+#include "path_history.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace libellus {
+
+PathHistory::PathHistory(const std::string& repo_path, std::string_view refname)
+    : repo(repo_path, refname)
+    , work(boost::asio::make_work_guard(ioc))
+{
+    thread = std::thread{[this] { ioc.run(); }};
+}
+
+PathHistory::~PathHistory()
+{
+    work.reset();
+    thread.join();
+}
+
+PathHistory::Page PathHistory::page(std::string path, size_t skip, size_t count)
+{
+    // One more than fits on the page tells whether there is an older page. A skip beyond the end of history just
+    // walks all of it, so the limit saturates rather than wrapping around to a short walk.
+    const size_t limit = skip >= SIZE_MAX - count ? SIZE_MAX : skip + count + 1;
+    const std::vector<Oid> commits = repo.history(std::move(path), limit);
+
+    Page result;
+    const size_t remaining = commits.size() - std::min(commits.size(), skip);
+    for (size_t i = 0; i < std::min(remaining, count); ++i) {
+        result.commits.emplace_back(repo.commit_info(commits[skip + i]));
+    }
+    result.has_older = remaining > count;
+    return result;
+}
+
+}  // namespace libellus
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+
+#include "repository.hpp"
+
+namespace libellus {
+
+/// Pages through the commits that changed a file or directory. Deep pages walk a long way back through history, so
+/// the walks run on a thread with a handle of its own rather than on the worker that asked. One walk runs at a time.
+class PathHistory {
+public:
+    struct Page {
+        std::vector<Repository::CommitInfo> commits;  // Newest first
+        bool has_older = false;
+    };
+
+    PathHistory(const std::string& repo_path, std::string_view refname);
+    ~PathHistory();
+
+    PathHistory(const PathHistory&) = delete;
+    PathHistory& operator=(const PathHistory&) = delete;
+
+    /// Up to `count` of the commits that changed `path`, after skipping the `skip` newest.
+    Page page(std::string path, size_t skip, size_t count);
+
+    /// Like page(), but run by the history's own thread so that the caller can get on with other work meanwhile.
+    /// Completes with page()'s result on the executor associated with the handler.
+    template<typename CompletionToken>
+    auto async_page(std::string path, size_t skip, size_t count, CompletionToken&& token)
+    {
+        return boost::asio::async_initiate<CompletionToken, void(Page)>(
+            [this](auto handler, std::string path, size_t skip, size_t count) {
+                auto work = boost::asio::make_work_guard(handler);
+                auto shared_handler = std::make_shared<decltype(handler)>(std::move(handler));
+                boost::asio::post(ioc, [this, shared_handler, work, path = std::move(path), skip, count]() mutable {
+                    Page result = page(std::move(path), skip, count);
+                    boost::asio::post(work.get_executor(), [shared_handler, result = std::move(result)]() mutable { (*shared_handler)(std::move(result)); });
+                    work.reset();
+                });
+            },
+            token, std::move(path), skip, count);
+    }
+
+private:
+    Repository repo;  // Only used by the thread
+
+    boost::asio::io_context ioc{1};
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    std::thread thread;
+};
+
+}  // namespace libellus
@@ -1,12 +1,233 @@
 #include "repository.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <system_error>
+
 #include <fmt/format.h>
 #include <git2.h>
+#include <git2/sys/commit_graph.h>
+#include <git2/sys/mempack.h>
 #include <mcl/assert.hpp>
 #include <mcl/scope_exit.hpp>
 
+#include "changed_path_filters.hpp"
+
 namespace libellus {
 
+namespace {
+
+std::optional<std::string> read_file(const std::string& path)
+{
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+        return std::nullopt;
+    }
+    return std::string{std::istreambuf_iterator<char>{file}, {}};
+}
+
+void check_error(int err)
+{
+    ASSERT_MSG(!err, "libgit2 error: {}\n", git_error_last()->message);
+}
+
+// The entry at `path` in `tree`, or null if there is none. Free it with git_tree_entry_free.
+git_tree_entry* find_entry(const git_tree* tree, const std::string& path)
+{
+    git_tree_entry* entry = nullptr;
+    if (const int err = git_tree_entry_bypath(&entry, tree, path.c_str()); err != GIT_ENOTFOUND) {
+        check_error(err);
+    }
+    return entry;
+}
+
+// Whether `path` names the same object with the same mode in both trees, or is missing from both.
+bool same_entry(const git_tree* a, const git_tree* b, const std::string& path)
+{
+    git_tree_entry* entry_a = find_entry(a, path);
+    SCOPE_EXIT { git_tree_entry_free(entry_a); };
+    git_tree_entry* entry_b = find_entry(b, path);
+    SCOPE_EXIT { git_tree_entry_free(entry_b); };
+
+    if (!entry_a || !entry_b) {
+        return !entry_a && !entry_b;
+    }
+    return git_oid_equal(git_tree_entry_id(entry_a), git_tree_entry_id(entry_b)) && git_tree_entry_filemode(entry_a) == git_tree_entry_filemode(entry_b);
+}
+
+// Whether each directory above `path` is a directory in both trees. Their contents may differ, but a directory
+// that became a file, or the other way around, leaves `path` missing from both trees without being the same.
+bool same_ancestors(const git_tree* a, const git_tree* b, const std::string& path)
+{
+    for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        const std::string dir = path.substr(0, slash);
+
+        git_tree_entry* entry_a = find_entry(a, dir);
+        SCOPE_EXIT { git_tree_entry_free(entry_a); };
+        git_tree_entry* entry_b = find_entry(b, dir);
+        SCOPE_EXIT { git_tree_entry_free(entry_b); };
+
+        const bool is_tree_a = entry_a && git_tree_entry_type(entry_a) == GIT_OBJECT_TREE;
+        const bool is_tree_b = entry_b && git_tree_entry_type(entry_b) == GIT_OBJECT_TREE;
+        if (!is_tree_a || !is_tree_b) {
+            // Nothing lies below a file or a missing entry, so this is as deep as the trees can be compared.
+            return !is_tree_a && !is_tree_b && same_entry(a, b, dir);
+        }
+    }
+    return true;
+}
+
+std::string_view trim_trailing_slashes(std::string_view path)
+{
+    return path.substr(0, path.find_last_not_of('/') + 1);
+}
+
+std::filesystem::path changed_path_filters_file(git_repository* repo)
+{
+    return std::filesystem::path{git_repository_commondir(repo)} / "objects" / "info" / "libellus-changed-paths";
+}
+
+// Calls `f` with HEAD and then every ref under refs/, whatever kind of object each points at.
+template<typename F>
+void for_each_ref(git_repository* repo, F f)
+{
+    git_reference* head;
+    check_error(git_reference_lookup(&head, repo, "HEAD"));
+    SCOPE_EXIT { git_reference_free(head); };
+    f(head);
+
+    git_reference_iterator* refs;
+    check_error(git_reference_iterator_new(&refs, repo));
+    SCOPE_EXIT { git_reference_iterator_free(refs); };
+
+    git_reference* ref;
+    int err;
+    while (!(err = git_reference_next(&ref, refs))) {
+        SCOPE_EXIT { git_reference_free(ref); };
+        f(ref);
+    }
+    if (err != GIT_ITEROVER) {
+        check_error(err);
+    }
+}
+
+// An object database holding only the pack whose index is `idx`, or null if it cannot be opened, as when the pack
+// is still being written.
+git_odb* open_pack(const std::filesystem::path& idx)
+{
+    git_odb_backend* backend;
+    if (git_odb_backend_one_pack(&backend, idx.c_str()) != GIT_OK) {
+        return nullptr;
+    }
+    git_odb* odb;
+    check_error(git_odb_new(&odb));
+    check_error(git_odb_add_backend(odb, backend, 1));
+    return odb;
+}
+
+// Whether every object in `pack` is also in `other`. False if `pack` cannot be read.
+bool contains_all(git_odb* pack, git_odb* other)
+{
+    return pack && git_odb_foreach(pack, [](const git_oid* id, void* payload) { return git_odb_exists(static_cast<git_odb*>(payload), id) ? 0 : GIT_EUSER; }, other) == GIT_OK;
+}
+
+// The object a loose object file named `name` in fan-out directory `fanout` holds, or nullopt if it is not named
+// like one, as a temporary file of a write in progress is not.
+std::optional<Oid> loose_object_id(std::string_view fanout, std::string_view name)
+{
+    const std::string hex = std::string{fanout} + std::string{name};
+    git_oid id;
+    if (hex.size() != 2 * std::tuple_size_v<decltype(Oid::oid)> || git_oid_fromstrn(&id, hex.data(), hex.size()) != GIT_OK) {
+        return std::nullopt;
+    }
+    return Oid{&id};
+}
+
+// Calls `f(entry, loose_object_id(...))` for each file in the fan-out directories of `objects_dir`.
+template<typename F>
+void for_each_loose_object(const std::filesystem::path& objects_dir, F f)
+{
+    std::error_code ec;
+    for (const auto& fanout : std::filesystem::directory_iterator{objects_dir, ec}) {
+        const auto name = fanout.path().filename().string();
+        if (name.size() != 2 || !std::isxdigit((unsigned char)name[0]) || !std::isxdigit((unsigned char)name[1])) {
+            continue;
+        }
+        for (const auto& entry : std::filesystem::directory_iterator{fanout.path(), ec}) {
+            f(entry, loose_object_id(name, entry.path().filename().string()));
+        }
+    }
+}
+
+// The object `ref` ends up at after following symbolic refs, or null if it is unborn or dangling.
+std::optional<Oid> ref_target(const git_reference* ref)
+{
+    git_reference* resolved;
+    if (const int err = git_reference_resolve(&resolved, ref); err == GIT_ENOTFOUND) {
+        return std::nullopt;
+    } else {
+        check_error(err);
+    }
+    SCOPE_EXIT { git_reference_free(resolved); };
+    return Oid{git_reference_target(resolved)};
+}
+
+// Pushes the commit `id` peels to onto `walk`. Returns false, pushing nothing, if `id` is missing or is not a
+// commit or a tag of one, as refs to trees and blobs are, and reflog entries for objects that were pruned.
+bool push_commit(git_repository* repo, git_revwalk* walk, const git_oid* id)
+{
+    git_object* object;
+    if (git_object_lookup(&object, repo, id, GIT_OBJECT_ANY)) {
+        return false;
+    }
+    SCOPE_EXIT { git_object_free(object); };
+
+    git_object* commit;
+    if (git_object_peel(&commit, object, GIT_OBJECT_COMMIT)) {
+        return false;
+    }
+    SCOPE_EXIT { git_object_free(commit); };
+
+    check_error(git_revwalk_push(walk, git_object_id(commit)));
+    return true;
+}
+
+}  // namespace
+
+bool is_valid_path(std::string_view path)
+{
+    if (path.find('\0') != std::string_view::npos) {
+        return false;
+    }
+
+    for (;;) {
+        const size_t slash = path.find('/');
+        const std::string_view component = path.substr(0, slash);
+
+        // Case-insensitive filesystems would take any spelling of .git for the real one.
+        const bool is_dot_git = component.size() == 4 && component[0] == '.' && std::tolower((unsigned char)component[1]) == 'g'
+                                && std::tolower((unsigned char)component[2]) == 'i' && std::tolower((unsigned char)component[3]) == 't';
+        if (component.empty() || component == "." || component == ".." || is_dot_git) {
+            return false;
+        }
+
+        if (slash == std::string_view::npos) {
+            return true;
+        }
+        path.remove_prefix(slash + 1);
+    }
+}
+
+void enable_fsync()
+{
+    // Never shut down again, so the setting outlives every Repository.
+    git_libgit2_init();
+    check_error(git_libgit2_opts(GIT_OPT_ENABLE_FSYNC_GITDIR, 1));
+}
+
 Oid::Oid() = default;
 
 Oid::Oid(const git_oid* g)
@@ -23,51 +244,531 @@ std::string Oid::to_string() const
         oid[10], oid[11], oid[12], oid[13], oid[14], oid[15], oid[16], oid[17], oid[18], oid[19]);
 }
 
-void Repository::check_error(int err) const
+bool PathIndex::Entry::is_blob() const
 {
-    ASSERT_MSG(!err, "libgit2 error: {}\n", git_error_last()->message);
+    return filemode == GIT_FILEMODE_BLOB || filemode == GIT_FILEMODE_BLOB_EXECUTABLE || filemode == GIT_FILEMODE_LINK;
 }
 
-std::string Repository::get_full_reference_name() const
+bool PathIndex::Entry::is_tree() const
 {
-    git_reference* ref;
-    git_reference_dwim(&ref, repo, refname.c_str());
-    SCOPE_EXIT { git_reference_free(ref); };
+    return filemode == GIT_FILEMODE_TREE;
+}
 
-    return git_reference_name(ref);
+const PathIndex::Entry* PathIndex::find(std::string_view path) const
+{
+    const auto iter = entries.find(path);
+    return iter != entries.end() ? &iter->second : nullptr;
 }
 
-git_commit* Repository::get_current_commit() const
+std::shared_ptr<PathIndex> PathIndex::build(git_repository* repo, const Oid& tree)
 {
-    git_reference* ref;
-    git_reference_dwim(&ref, repo, refname.c_str());
-    SCOPE_EXIT { git_reference_free(ref); };
+    git_tree* root;
+    check_error(git_tree_lookup(&root, repo, tree));
+    SCOPE_EXIT { git_tree_free(root); };
+
+    auto index = std::make_shared<PathIndex>();
+    check_error(git_tree_walk(
+        root, GIT_TREEWALK_PRE, [](const char* dir, const git_tree_entry* entry, void* payload) {
+            auto& entries = *(decltype(PathIndex::entries)*)payload;
+            entries.insert_or_assign(std::string{dir} + git_tree_entry_name(entry), Entry{git_tree_entry_id(entry), (u32)git_tree_entry_filemode(entry)});
+            return 0;
+        },
+        &index->entries));
+    return index;
+}
+
+void PathIndex::update(git_repository* repo, const Oid& old_tree, const Oid& new_tree)
+{
+    git_tree* old_root;
+    check_error(git_tree_lookup(&old_root, repo, old_tree));
+    SCOPE_EXIT { git_tree_free(old_root); };
+
+    git_tree* new_root;
+    check_error(git_tree_lookup(&new_root, repo, new_tree));
+    SCOPE_EXIT { git_tree_free(new_root); };
+
+    // Only subtrees whose Oids differ are descended into, so this costs in proportion to the change.
+    git_diff* diff;
+    check_error(git_diff_tree_to_tree(&diff, repo, old_root, new_root, nullptr));
+    SCOPE_EXIT { git_diff_free(diff); };
+
+    // The diff lists files only. Every directory above a changed file has a new tree, or has appeared or gone away.
+    std::set<std::string> dirs;
+
+    const size_t count = git_diff_num_deltas(diff);
+    for (size_t i = 0; i < count; ++i) {
+        const git_diff_delta* delta = git_diff_get_delta(diff, i);
+        const std::string_view path = delta->new_file.path;
+
+        if (delta->status == GIT_DELTA_DELETED) {
+            if (const auto iter = entries.find(path); iter != entries.end()) {
+                entries.erase(iter);
+            }
+        } else {
+            entries.insert_or_assign(std::string{path}, Entry{&delta->new_file.id, delta->new_file.mode});
+        }
+
+        for (size_t slash = path.rfind('/'); slash != std::string_view::npos && slash != 0; slash = path.rfind('/', slash - 1)) {
+            if (!dirs.emplace(path.substr(0, slash)).second) {
+                break;
+            }
+        }
+    }
+
+    for (const auto& dir : dirs) {
+        git_tree_entry* entry = nullptr;
+        const int err = git_tree_entry_bypath(&entry, new_root, dir.c_str());
+        if (err == GIT_ENOTFOUND) {
+            entries.erase(dir);
+            continue;
+        }
+        check_error(err);
+        SCOPE_EXIT { git_tree_entry_free(entry); };
+
+        entries.insert_or_assign(dir, Entry{git_tree_entry_id(entry), (u32)git_tree_entry_filemode(entry)});
+    }
+}
+
+Snapshot::Snapshot(const std::optional<Oid>& commit, std::shared_ptr<git_tree> root, std::shared_ptr<const PathIndex> paths)
+    : commit_oid(commit), tree_oid(git_tree_id(root.get())), root(std::move(root)), paths(std::move(paths))
+{}
+
+std::optional<const PathIndex::Entry*> Snapshot::find_indexed(std::string_view path) const
+{
+    if (!paths) {
+        return std::nullopt;
+    }
+    return paths->find(path);
+}
+
+std::optional<TreeView> Snapshot::list(std::string path) const
+{
+    path.erase(0, path.find_first_not_of('/'));
+    path.resize(trim_trailing_slashes(path).size());
+
+    if (path.empty()) {
+        return TreeView{root};
+    }
+
+    if (const auto indexed = find_indexed(path)) {
+        if (!*indexed || !(*indexed)->is_tree()) {
+            return {};
+        }
+
+        git_tree* dir;
+        check_error(git_tree_lookup(&dir, git_tree_owner(root.get()), (*indexed)->oid));
+        return TreeView{std::shared_ptr<git_tree>{dir, git_tree_free}};
+    }
+
+    git_tree* dir = nullptr;
+    const int err = git_object_lookup_bypath((git_object**)&dir, (const git_object*)root.get(), path.c_str(), GIT_OBJ_TREE);
+    if (err == GIT_ENOTFOUND) {
+        git_tree_free(dir);
+        return {};
+    }
+    check_error(err);
+
+    return TreeView{std::shared_ptr<git_tree>{dir, git_tree_free}};
+}
+
+std::optional<File> Snapshot::stat(std::string path) const
+{
+    // Trailing slashes are ignored with or without the index; git_tree_entry_bypath would not find "a/b/" otherwise.
+    path.erase(0, path.find_first_not_of('/'));
+    path.resize(trim_trailing_slashes(path).size());
+
+    if (path.empty()) {
+        return File{
+            .is_blob = false,
+            .name = "",
+            .oid = git_tree_id(root.get()),
+        };
+    }
+
+    if (const auto indexed = find_indexed(path)) {
+        if (!*indexed) {
+            return {};
+        }
+
+        return File{
+            .is_blob = (*indexed)->is_blob(),
+            .name = path.substr(path.rfind('/') + 1),
+            .oid = (*indexed)->oid,
+        };
+    }
+
+    git_tree_entry* entry = nullptr;
+    const int err = git_tree_entry_bypath(&entry, root.get(), path.c_str());
+    if (err == GIT_ENOTFOUND) {
+        return {};
+    }
+    check_error(err);
+    SCOPE_EXIT { git_tree_entry_free(entry); };
+
+    return File{
+        .is_blob = git_tree_entry_type(entry) == GIT_OBJECT_BLOB,
+        .name = git_tree_entry_name(entry),
+        .oid = git_tree_entry_id(entry),
+    };
+}
+
+std::optional<BlobView> Snapshot::read(std::string path) const
+{
+    path.erase(0, path.find_first_not_of('/'));
+    path.resize(trim_trailing_slashes(path).size());
+    ASSERT(!path.empty());
+
+    if (const auto indexed = find_indexed(path)) {
+        if (!*indexed || !(*indexed)->is_blob()) {
+            return {};
+        }
+
+        git_blob* blob;
+        check_error(git_blob_lookup(&blob, git_tree_owner(root.get()), (*indexed)->oid));
+        return BlobView{std::shared_ptr<git_blob>{blob, git_blob_free}};
+    }
+
+    git_blob* blob = nullptr;
+    const int err = git_object_lookup_bypath((git_object**)&blob, (const git_object*)root.get(), path.c_str(), GIT_OBJ_BLOB);
+    if (err == GIT_ENOTFOUND) {
+        git_blob_free(blob);
+        return {};
+    }
+    check_error(err);
+
+    return BlobView{std::shared_ptr<git_blob>{blob, git_blob_free}};
+}
+
+TreeView::TreeView(std::shared_ptr<git_tree> tree)
+    : tree_oid(git_tree_id(tree.get())), tree(std::move(tree))
+{}
+
+size_t TreeView::size() const
+{
+    return git_tree_entrycount(tree.get());
+}
+
+TreeView::Entry TreeView::operator[](size_t index) const
+{
+    const git_tree_entry* te = git_tree_entry_byindex(tree.get(), index);
+    return Entry{
+        .is_blob = git_tree_entry_type(te) == GIT_OBJECT_BLOB,
+        .is_tree = git_tree_entry_type(te) == GIT_OBJECT_TREE,
+        .name = git_tree_entry_name(te),
+        .oid = git_tree_entry_id(te),
+    };
+}
+
+BlobView::BlobView(std::shared_ptr<git_blob> blob)
+    : blob(std::move(blob))
+{}
+
+const std::byte* BlobView::data() const
+{
+    return (const std::byte*)git_blob_rawcontent(blob.get());
+}
+
+size_t BlobView::size() const
+{
+    return (size_t)git_blob_rawsize(blob.get());
+}
+
+BlobWriter::BlobWriter(git_writestream* stream)
+    : stream(stream)
+{}
+
+BlobWriter::BlobWriter(BlobWriter&& other)
+    : stream(std::exchange(other.stream, nullptr))
+{}
+
+BlobWriter& BlobWriter::operator=(BlobWriter&& other)
+{
+    if (this != &other) {
+        if (stream) {
+            stream->free(stream);
+        }
+        stream = std::exchange(other.stream, nullptr);
+    }
+    return *this;
+}
+
+BlobWriter::~BlobWriter()
+{
+    // Also removes the temporary file holding what has been written so far.
+    if (stream) {
+        stream->free(stream);
+    }
+}
+
+void BlobWriter::write(std::string_view data)
+{
+    ASSERT(stream);
+    check_error(stream->write(stream, data.data(), data.size()));
+}
+
+Oid BlobWriter::finish() &&
+{
+    ASSERT(stream);
+
+    // Frees the stream whether or not it succeeds.
+    git_oid blob_oid;
+    check_error(git_blob_create_from_stream_commit(&blob_oid, std::exchange(stream, nullptr)));
+    return &blob_oid;
+}
+
+Transaction::Transaction(git_repository* repo)
+    : repo(repo)
+{}
+
+void Transaction::upsert(std::string path, std::string_view contents)
+{
+    git_oid blob_oid;
+    check_error(git_blob_create_from_buffer(&blob_oid, repo, contents.data(), contents.size()));
+    upsert(std::move(path), &blob_oid);
+}
+
+void Transaction::upsert(std::string path, const Oid& blob, bool executable)
+{
+    path.erase(0, path.find_first_not_of('/'));
+    if (!is_valid_path(path)) {
+        return fail(fmt::format("invalid path {}", path));
+    }
+
+    changes.insert_or_assign(std::move(path), Change{
+                                                  .action = Action::Upsert,
+                                                  .oid = blob,
+                                                  .filemode = executable ? GIT_FILEMODE_BLOB_EXECUTABLE : GIT_FILEMODE_BLOB,
+                                                  .source = {},
+                                              });
+}
+
+void Transaction::remove(std::string path)
+{
+    path.erase(0, path.find_first_not_of('/'));
+    if (!is_valid_path(path)) {
+        return fail(fmt::format("invalid path {}", path));
+    }
+
+    // Whatever was staged under a removed directory goes with it.
+    discard_changes_under(path);
+
+    changes.insert_or_assign(std::move(path), Change{
+                                                  .action = Action::Remove,
+                                                  .oid = {},
+                                                  .filemode = GIT_FILEMODE_UNREADABLE,
+                                                  .source = {},
+                                              });
+}
+
+void Transaction::rename(std::string from, std::string to)
+{
+    from.erase(0, from.find_first_not_of('/'));
+    to.erase(0, to.find_first_not_of('/'));
+    if (!is_valid_path(from) || !is_valid_path(to)) {
+        return fail(fmt::format("invalid rename from {} to {}", from, to));
+    }
+
+    if (from == to) {
+        return;
+    }
+    if (to.starts_with(from + "/")) {
+        return fail(fmt::format("cannot move {} into itself", from));
+    }
+
+    Change moved{
+        .action = Action::CopyFromBase,
+        .oid = {},
+        .filemode = GIT_FILEMODE_UNREADABLE,
+        .source = from,
+    };
+    if (const auto iter = changes.find(from); iter != changes.end()) {
+        if (iter->second.action == Action::Remove) {
+            return fail(fmt::format("rename source {} was removed", from));
+        }
+        moved = iter->second;
+    }
+
+    // Changes staged under the source are applied on top of the copy of it.
+    const std::string from_prefix = from + "/";
+    std::vector<std::pair<std::string, Change>> moved_children;
+    for (auto iter = changes.lower_bound(from_prefix); iter != changes.end() && iter->first.starts_with(from_prefix);) {
+        moved_children.emplace_back(fmt::format("{}/{}", to, std::string_view{iter->first}.substr(from_prefix.size())), std::move(iter->second));
+        iter = changes.erase(iter);
+    }
+
+    // The destination is replaced as a whole, along with anything staged under it.
+    discard_changes_under(to);
+
+    changes.insert_or_assign(to, std::move(moved));
+    for (auto& [path, change] : moved_children) {
+        changes.insert_or_assign(std::move(path), std::move(change));
+    }
+
+    // A source inside the destination went away with the rest of it.
+    if (!from.starts_with(to + "/")) {
+        remove(std::move(from));
+    }
+}
+
+bool Transaction::has_changes_under(const std::string& dir) const
+{
+    const std::string prefix = dir + "/";
+    const auto iter = changes.lower_bound(prefix);
+    return iter != changes.end() && iter->first.starts_with(prefix);
+}
+
+void Transaction::discard_changes_under(const std::string& dir)
+{
+    const std::string prefix = dir + "/";
+    for (auto iter = changes.lower_bound(prefix); iter != changes.end() && iter->first.starts_with(prefix);) {
+        iter = changes.erase(iter);
+    }
+}
+
+void Transaction::fail(std::string message)
+{
+    if (failure.empty()) {
+        failure = std::move(message);
+    }
+}
+
+bool Transaction::unaffected_between(git_repository* repo, const Oid& before, const Oid& after) const
+{
+    git_tree* before_root;
+    check_error(git_tree_lookup(&before_root, repo, before));
+    SCOPE_EXIT { git_tree_free(before_root); };
+
+    git_tree* after_root;
+    check_error(git_tree_lookup(&after_root, repo, after));
+    SCOPE_EXIT { git_tree_free(after_root); };
+
+    const auto same = [&](const std::string& path) {
+        return same_ancestors(before_root, after_root, path) && same_entry(before_root, after_root, path);
+    };
+
+    for (const auto& [path, change] : changes) {
+        if (!same(path)) {
+            return false;
+        }
+        if (change.action == Action::CopyFromBase && !same(change.source)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    git_reference* resolved_ref;
-    git_reference_resolve(&resolved_ref, ref);
-    SCOPE_EXIT { git_reference_free(resolved_ref); };
+Repository::RefState Repository::read_ref_state(const std::vector<std::string>& ref_chain) const
+{
+    RefState result;
+
+    for (const auto& name : ref_chain) {
+        // Pseudo-refs such as HEAD are per-worktree; everything under refs/ is shared.
+        const std::string path = (name.starts_with("refs/") ? git_repository_commondir(repo) : git_repository_path(repo)) + name;
+        result.loose_refs.emplace_back(read_file(path));
+    }
+
+    // Either call failing, most often because there is no packed-refs file, leaves the state without it.
+    std::error_code mtime_ec, size_ec;
+    const std::string packed_refs_path = git_repository_commondir(repo) + std::string{"packed-refs"};
+    const auto mtime = std::filesystem::last_write_time(packed_refs_path, mtime_ec);
+    const auto size = std::filesystem::file_size(packed_refs_path, size_ec);
+    if (!mtime_ec && !size_ec) {
+        result.packed_refs = {mtime, size};
+    }
 
-    const git_oid* ref_target = git_reference_target(resolved_ref);
-    git_commit* result;
-    git_commit_lookup(&result, repo, ref_target);
     return result;
 }
 
-git_tree* Repository::get_current_tree() const
+const Repository::Head& Repository::get_head() const
 {
-    git_commit* commit = get_current_commit();
+    if (head && read_ref_state(head->ref_chain) == head->ref_state) {
+        return *head;
+    }
+
+    // Follows symbolic refs down to the direct one, which does not exist yet while the ref is unborn.
+    std::vector<std::string> ref_chain{full_refname};
+    for (;;) {
+        git_reference* ref;
+        if (const int err = git_reference_lookup(&ref, repo, ref_chain.back().c_str()); err == GIT_ENOTFOUND) {
+            break;
+        } else {
+            check_error(err);
+        }
+        SCOPE_EXIT { git_reference_free(ref); };
+        if (git_reference_type(ref) != GIT_REFERENCE_SYMBOLIC) {
+            break;
+        }
+        ref_chain.emplace_back(git_reference_symbolic_target(ref));
+    }
+
+    // The state is read before the target so that a concurrent update can only make the cache look stale, never hide.
+    RefState ref_state = read_ref_state(ref_chain);
+
+    git_oid commit_oid;
+    if (const int err = git_reference_name_to_id(&commit_oid, repo, full_refname.c_str()); err == GIT_ENOTFOUND) {
+        // Until the first commit there is nothing to read. libgit2 reads the empty tree without it being stored.
+        git_oid empty_tree_oid;
+        check_error(git_odb_hash(&empty_tree_oid, "", 0, GIT_OBJECT_TREE));
+        head = Head{
+            .commit = std::nullopt,
+            .tree = &empty_tree_oid,
+            .ref_chain = std::move(ref_chain),
+            .ref_state = std::move(ref_state),
+        };
+        return *head;
+    } else {
+        check_error(err);
+    }
+
+    git_commit* commit;
+    check_error(git_commit_lookup(&commit, repo, &commit_oid));
     SCOPE_EXIT { git_commit_free(commit); };
 
-    git_tree* result;
-    git_commit_tree(&result, commit);
-    return result;
+    head = Head{
+        .commit = Oid{&commit_oid},
+        .tree = git_commit_tree_id(commit),
+        .ref_chain = std::move(ref_chain),
+        .ref_state = std::move(ref_state),
+    };
+    return *head;
 }
 
-Repository::Repository(const std::string& repo_path, std::string_view refname_)
+Repository::Repository(const std::string& repo_path, std::string_view refname_, bool stage_writes, bool index_paths)
     : refname(refname_)
+    , index_paths(index_paths)
 {
     git_libgit2_init();
     check_error(git_repository_open(&repo, repo_path.c_str()));
+
+    if (stage_writes) {
+        git_odb* odb;
+        check_error(git_repository_odb(&odb, repo));
+        SCOPE_EXIT { git_odb_free(odb); };
+
+        // The highest priority backend that can write receives every new object; the odb takes ownership.
+        check_error(git_mempack_new(&mempack));
+        check_error(git_odb_add_backend(odb, mempack, 999));
+    }
+
+    git_reference* ref;
+    if (const int err = git_reference_dwim(&ref, repo, refname.c_str()); err != GIT_ENOTFOUND) {
+        check_error(err);
+        SCOPE_EXIT { git_reference_free(ref); };
+        full_refname = git_reference_name(ref);
+        return;
+    }
+
+    // The ref is unborn, as the branch HEAD names in a freshly initialised repository is. Follow whatever symbolic
+    // refs do exist to the name the first commit will create.
+    full_refname = refname == "HEAD" || refname.starts_with("refs/") ? refname : "refs/heads/" + refname;
+    git_reference* link;
+    while (git_reference_lookup(&link, repo, full_refname.c_str()) == GIT_OK) {
+        SCOPE_EXIT { git_reference_free(link); };
+        if (git_reference_type(link) != GIT_REFERENCE_SYMBOLIC) {
+            break;
+        }
+        full_refname = git_reference_symbolic_target(link);
+    }
 }
 
 Repository::~Repository()
@@ -76,99 +777,644 @@ Repository::~Repository()
     git_libgit2_shutdown();
 }
 
-std::optional<std::vector<File>> Repository::list(std::string path) const
+Snapshot Repository::snapshot() const
 {
-    path.erase(0, path.find_first_not_of('/'));
+    const Head& current = get_head();
 
-    git_tree* root = get_current_tree();
-    SCOPE_EXIT { git_tree_free(root); };
+    git_tree* root;
+    check_error(git_tree_lookup(&root, repo, current.tree));
+    return Snapshot{current.commit, std::shared_ptr<git_tree>{root, git_tree_free}, index_for(current.tree)};
+}
 
-    git_tree* dir = nullptr;
-    if (path.empty() || path == "/") {
-        git_tree_dup(&dir, root);
-    } else {
-        const int err = git_object_lookup_bypath((git_object**)&dir, (const git_object*)root, path.c_str(), GIT_OBJ_TREE);
-        if (err == GIT_ENOTFOUND) {
-            git_tree_free(dir);
-            return {};
+std::shared_ptr<const PathIndex> Repository::index_for(const Oid& tree) const
+{
+    if (!index_paths) {
+        return nullptr;
+    }
+
+    if (!paths) {
+        paths = PathIndex::build(repo, tree);
+    } else if (paths_tree != tree) {
+        // Snapshots still holding the old index keep it; otherwise it is updated where it is.
+        if (paths.use_count() > 1) {
+            paths = std::make_shared<PathIndex>(*paths);
         }
-        check_error(err);
+        paths->update(repo, paths_tree, tree);
+    }
+    paths_tree = tree;
+
+    return paths;
+}
+
+std::optional<TreeView> Repository::list(std::string path) const
+{
+    return snapshot().list(std::move(path));
+}
+
+TreeView Repository::list(const Oid& tree) const
+{
+    git_tree* dir;
+    check_error(git_tree_lookup(&dir, repo, tree));
+    return TreeView{std::shared_ptr<git_tree>{dir, git_tree_free}};
+}
+
+std::optional<File> Repository::stat(std::string path) const
+{
+    return snapshot().stat(std::move(path));
+}
+
+CommitResult Repository::commit(const std::string& commit_message, std::string path, std::string_view contents)
+{
+    Transaction transaction = this->transaction();
+    transaction.upsert(std::move(path), contents);
+    return commit(commit_message, transaction);
+}
+
+BlobWriter Repository::write_blob()
+{
+    // Without a hint path no filters apply, so the blob holds exactly the bytes written.
+    git_writestream* stream;
+    check_error(git_blob_create_from_stream(&stream, repo, nullptr));
+    return BlobWriter{stream};
+}
+
+Oid Repository::write_blob(std::string_view contents)
+{
+    git_oid blob_oid;
+    check_error(git_blob_create_from_buffer(&blob_oid, repo, contents.data(), contents.size()));
+    return &blob_oid;
+}
+
+void Repository::flush_staged_objects()
+{
+    if (!mempack) {
+        return;
     }
-    SCOPE_EXIT { git_tree_free(dir); };
 
-    std::vector<File> files;
-    const size_t sz = git_tree_entrycount(dir);
-    for (size_t i = 0; i < sz; ++i) {
-        const git_tree_entry* te = git_tree_entry_byindex(dir, i);
+    git_buf pack{};
+    check_error(git_mempack_dump(&pack, repo, mempack));
+    SCOPE_EXIT { git_buf_dispose(&pack); };
 
-        files.emplace_back(File{
-            .is_blob = git_tree_entry_type(te) == GIT_OBJECT_BLOB,
-            .oid = git_tree_entry_id(te),
-            .name = git_tree_entry_name(te),
-        });
+    git_odb* odb;
+    check_error(git_repository_odb(&odb, repo));
+    SCOPE_EXIT { git_odb_free(odb); };
+
+    // Indexes the pack and moves it into objects/pack, where every handle's pack backend will find it.
+    git_odb_writepack* writepack;
+    check_error(git_odb_write_pack(&writepack, odb, nullptr, nullptr));
+    SCOPE_EXIT { writepack->free(writepack); };
+
+    git_indexer_progress stats{};
+    check_error(writepack->append(writepack, pack.ptr, pack.size, &stats));
+    check_error(writepack->commit(writepack, &stats));
+
+    check_error(git_mempack_reset(mempack));
+}
+
+Transaction Repository::transaction()
+{
+    return Transaction{repo};
+}
+
+CommitResult Repository::commit(const std::string& commit_message, const Transaction& transaction)
+{
+    ASSERT(!transaction.empty());
+
+    if (!transaction.failure.empty()) {
+        return CommitError{CommitError::Kind::Invalid, transaction.failure};
     }
-    return files;
+
+    const std::string reflog_message = fmt::format("commit: {}", std::string_view{commit_message}.substr(0, commit_message.find('\n')));
+
+    // While the ref is unborn there is no parent, and the commit is a root commit that creates it.
+    const Oid base_tree = get_head().tree;
+    std::optional<Oid> parent = get_head().commit;
+
+    for (size_t attempt = 0; attempt < max_commit_attempts; ++attempt) {
+        const auto created = create_commit(commit_message, transaction, parent);
+        if (const auto* error = std::get_if<CommitError>(&created)) {
+            return *error;
+        }
+        const auto [new_commit_oid, new_tree_oid] = std::get<std::pair<Oid, Oid>>(created);
+
+        // Only move the ref if nobody else has since the parent was read.
+        if (update_ref(new_commit_oid, parent, reflog_message)) {
+            // Adopt the new commit as HEAD without resolving the ref again, unless another writer already moved it.
+            std::vector<std::string> ref_chain = std::move(head->ref_chain);
+            RefState ref_state = read_ref_state(ref_chain);
+            git_oid current_oid;
+            check_error(git_reference_name_to_id(&current_oid, repo, full_refname.c_str()));
+            if (Oid{&current_oid} == new_commit_oid) {
+                head = Head{
+                    .commit = new_commit_oid,
+                    .tree = new_tree_oid,
+                    .ref_chain = std::move(ref_chain),
+                    .ref_state = std::move(ref_state),
+                };
+            } else {
+                head.reset();
+            }
+
+            return new_commit_oid;
+        }
+
+        // Another writer got there first. If it left every path this transaction touches alone,
+        // the same changes apply cleanly on top of its commit; otherwise the caller has to decide.
+        head.reset();
+        const Head& latest = get_head();
+        if (!transaction.unaffected_between(repo, base_tree, latest.tree)) {
+            return CommitError{CommitError::Kind::Conflict, "modified concurrently"};
+        }
+        parent = latest.commit;
+    }
+
+    return CommitError{CommitError::Kind::Conflict, "modified concurrently"};
 }
 
-void Repository::commit(const std::string& commit_message, std::string path, std::string_view contents)
+bool Repository::update_ref(const Oid& commit, const std::optional<Oid>& expected, const std::string& reflog_message)
 {
-    path.erase(0, path.find_first_not_of('/'));
-    ASSERT(!path.empty());
+    // The ref is locked before staged objects are written out, so that only the attempt that moves it writes a pack.
+    git_transaction* ref_transaction;
+    check_error(git_transaction_new(&ref_transaction, repo));
+    SCOPE_EXIT { git_transaction_free(ref_transaction); };
+    if (const int err = git_transaction_lock_ref(ref_transaction, full_refname.c_str()); err == GIT_ELOCKED) {
+        return false;  // Another writer is moving it right now
+    } else {
+        check_error(err);
+    }
+
+    git_oid current_oid;
+    const int err = git_reference_name_to_id(&current_oid, repo, full_refname.c_str());
+    if (err != GIT_ENOTFOUND) {
+        check_error(err);
+    }
+    if ((err == GIT_ENOTFOUND ? std::nullopt : std::optional<Oid>{&current_oid}) != expected) {
+        return false;
+    }
 
-    git_tree* old_root = get_current_tree();
+    // Other handles onto the repository will read the commit as soon as the ref moves.
+    flush_staged_objects();
+
+    check_error(git_transaction_set_target(ref_transaction, full_refname.c_str(), commit, nullptr, reflog_message.c_str()));
+    check_error(git_transaction_commit(ref_transaction));
+    return true;
+}
+
+std::variant<std::pair<Oid, Oid>, CommitError> Repository::create_commit(const std::string& commit_message, const Transaction& transaction, const std::optional<Oid>& parent)
+{
+    git_commit* parent_commit = nullptr;
+    git_tree* old_root;
+    if (parent) {
+        check_error(git_commit_lookup(&parent_commit, repo, *parent));
+        check_error(git_commit_tree(&old_root, parent_commit));
+    } else {
+        // A root commit starts from the empty tree, which is written out so that the commit never refers to a missing
+        // object, even for tools that do not special-case it as libgit2 does.
+        git_treebuilder* builder;
+        check_error(git_treebuilder_new(&builder, repo, nullptr));
+        SCOPE_EXIT { git_treebuilder_free(builder); };
+        git_oid empty_tree_oid;
+        check_error(git_treebuilder_write(&empty_tree_oid, builder));
+        check_error(git_tree_lookup(&old_root, repo, &empty_tree_oid));
+    }
+    SCOPE_EXIT { git_commit_free(parent_commit); };
     SCOPE_EXIT { git_tree_free(old_root); };
 
-    git_commit* old_commit = get_current_commit();
-    SCOPE_EXIT { git_commit_free(old_commit); };
+    std::vector<git_tree_update> updates;
+    updates.reserve(transaction.changes.size());
+    for (const auto& [path, change] : transaction.changes) {
+        switch (change.action) {
+        case Transaction::Action::Upsert:
+            updates.emplace_back(git_tree_update{GIT_TREE_UPDATE_UPSERT, *(const git_oid*)change.oid, (git_filemode_t)change.filemode, path.c_str()});
+            break;
+        case Transaction::Action::Remove: {
+            // Removing what is already gone changes nothing, rather than failing the whole tree update.
+            git_tree_entry* entry = find_entry(old_root, path);
+            git_tree_entry_free(entry);
+            if (!entry) {
+                break;
+            }
 
-    git_oid blob_oid;
-    git_blob_create_frombuffer(&blob_oid, repo, contents.data(), contents.size());
+            updates.emplace_back(git_tree_update{GIT_TREE_UPDATE_REMOVE, {}, GIT_FILEMODE_UNREADABLE, path.c_str()});
+            break;
+        }
+        case Transaction::Action::CopyFromBase: {
+            git_tree_entry* entry = find_entry(old_root, change.source);
+            SCOPE_EXIT { git_tree_entry_free(entry); };
+            if (!entry) {
+                // A directory that only exists in this transaction is built from the changes moved under it.
+                if (transaction.has_changes_under(path)) {
+                    break;
+                }
+                return CommitError{CommitError::Kind::Invalid, fmt::format("rename source {} does not exist", change.source)};
+            }
 
-    git_tree_update update{
-        GIT_TREE_UPDATE_UPSERT,
-        blob_oid,
-        GIT_FILEMODE_BLOB,
-        path.c_str(),
-    };
+            updates.emplace_back(git_tree_update{GIT_TREE_UPDATE_UPSERT, *git_tree_entry_id(entry), git_tree_entry_filemode(entry), path.c_str()});
+            break;
+        }
+        }
+    }
 
+    // Fails when the changes contradict the tree, such as a file under a path that is a file itself.
     git_oid new_tree_oid;
-    git_tree_create_updated(&new_tree_oid, repo, old_root, 1, &update);
+    if (git_tree_create_updated(&new_tree_oid, repo, old_root, updates.size(), updates.data()) != GIT_OK) {
+        return CommitError{CommitError::Kind::Invalid, git_error_last()->message};
+    }
     git_tree* new_root;
-    git_tree_lookup(&new_root, repo, &new_tree_oid);
+    check_error(git_tree_lookup(&new_root, repo, &new_tree_oid));
     SCOPE_EXIT { git_tree_free(new_root); };
 
     git_signature* sig;
     git_signature_now(&sig, "libellus", "libellus@mary.rs");
     SCOPE_EXIT { git_signature_free(sig); };
 
-    const std::string update_ref = get_full_reference_name();
-    const git_commit* parents[1]{old_commit};
+    const git_commit* parents[1]{parent_commit};
     git_oid new_commit_oid;
-    git_commit_create(&new_commit_oid, repo, update_ref.c_str(), sig, sig, "UTF-8", commit_message.c_str(), new_root, 1, parents);
+    check_error(git_commit_create(&new_commit_oid, repo, nullptr, sig, sig, "UTF-8", commit_message.c_str(), new_root, parent_commit ? 1 : 0, parents));
+
+    return std::pair<Oid, Oid>{&new_commit_oid, &new_tree_oid};
 }
 
-std::optional<std::string> Repository::read(std::string path) const
+std::optional<std::vector<Oid>> Repository::first_parent_chain(const std::optional<Oid>& since, const Oid& until) const
+{
+    std::vector<Oid> commits;
+    for (Oid current = until; !since || current != *since;) {
+        commits.emplace_back(current);
+
+        git_commit* commit;
+        check_error(git_commit_lookup(&commit, repo, current));
+        SCOPE_EXIT { git_commit_free(commit); };
+
+        if (git_commit_parentcount(commit) == 0) {
+            if (since) {
+                return std::nullopt;
+            }
+            break;
+        }
+        current = git_commit_parent_id(commit, 0);
+    }
+
+    std::reverse(commits.begin(), commits.end());
+    return commits;
+}
+
+bool Repository::first_parent_commits(const std::optional<Oid>& since, const Oid& until, const std::function<void(const CommitInfo& commit)>& visit) const
+{
+    const auto commits = first_parent_chain(since, until);
+    if (!commits) {
+        return false;
+    }
+
+    for (const Oid& oid : *commits) {
+        visit(commit_info(oid));
+    }
+
+    return true;
+}
+
+Repository::CommitInfo Repository::commit_info(const Oid& oid) const
+{
+    git_commit* commit;
+    check_error(git_commit_lookup(&commit, repo, oid));
+    SCOPE_EXIT { git_commit_free(commit); };
+
+    const git_signature* author = git_commit_author(commit);
+    const char* summary = git_commit_summary(commit);
+
+    CommitInfo info;
+    info.oid = oid;
+    for (unsigned int i = 0; i < git_commit_parentcount(commit); ++i) {
+        info.parents.emplace_back(git_commit_parent_id(commit, i));
+    }
+    info.author_time = author->when.time;
+    info.author = fmt::format("{} <{}>", author->name, author->email);
+    info.summary = summary ? summary : "";
+    return info;
+}
+
+bool Repository::first_parent_changes(const std::optional<Oid>& since, const Oid& until, const std::function<void(const Oid& commit, s64 time, const std::vector<PathChange>& changes)>& visit) const
+{
+    const auto commits = first_parent_chain(since, until);
+    if (!commits) {
+        return false;
+    }
+
+    std::vector<PathChange> changes;
+    for (const Oid& oid : *commits) {
+        git_commit* commit;
+        check_error(git_commit_lookup(&commit, repo, oid));
+        SCOPE_EXIT { git_commit_free(commit); };
+
+        git_tree* tree;
+        check_error(git_commit_tree(&tree, commit));
+        SCOPE_EXIT { git_tree_free(tree); };
+
+        // A root commit is compared with the empty tree.
+        git_tree* parent_tree = nullptr;
+        if (git_commit_parentcount(commit) != 0) {
+            git_commit* parent;
+            check_error(git_commit_parent(&parent, commit, 0));
+            SCOPE_EXIT { git_commit_free(parent); };
+            check_error(git_commit_tree(&parent_tree, parent));
+        }
+        SCOPE_EXIT { git_tree_free(parent_tree); };
+
+        git_diff* diff;
+        check_error(git_diff_tree_to_tree(&diff, repo, parent_tree, tree, nullptr));
+        SCOPE_EXIT { git_diff_free(diff); };
+
+        changes.clear();
+        const size_t count = git_diff_num_deltas(diff);
+        for (size_t i = 0; i < count; ++i) {
+            const git_diff_delta* delta = git_diff_get_delta(diff, i);
+            changes.emplace_back(PathChange{delta->new_file.path, delta->status == GIT_DELTA_DELETED});
+        }
+
+        visit(oid, git_commit_time(commit), changes);
+    }
+
+    return true;
+}
+
+std::vector<Oid> Repository::history(std::string path, size_t limit) const
 {
     path.erase(0, path.find_first_not_of('/'));
-    ASSERT(!path.empty());
+    path.resize(trim_trailing_slashes(path).size());
 
-    git_tree* root = get_current_tree();
-    SCOPE_EXIT { git_tree_free(root); };
+    const auto filters = changed_path_filters();
 
-    git_blob* blob = nullptr;
-    const int err = git_object_lookup_bypath((git_object**)&blob, (const git_object*)root, path.c_str(), GIT_OBJ_BLOB);
-    if (err == GIT_ENOTFOUND) {
-        git_blob_free(blob);
-        return {};
+    std::vector<Oid> result;
+    std::optional<Oid> current = get_head().commit;
+    while (current && result.size() < limit) {
+        git_commit* commit;
+        check_error(git_commit_lookup(&commit, repo, *current));
+        SCOPE_EXIT { git_commit_free(commit); };
+
+        const bool has_parent = git_commit_parentcount(commit) != 0;
+        const Oid parent_oid = has_parent ? Oid{git_commit_parent_id(commit, 0)} : Oid{};
+
+        // Every commit changes the root directory, bar empty ones; those are rare enough not to bother filtering.
+        bool changed = path.empty() || filters->maybe_changed(*current, path);
+        if (changed) {
+            git_tree* tree;
+            check_error(git_commit_tree(&tree, commit));
+            SCOPE_EXIT { git_tree_free(tree); };
+
+            git_tree* parent_tree = nullptr;
+            if (has_parent) {
+                git_commit* parent;
+                check_error(git_commit_lookup(&parent, repo, parent_oid));
+                SCOPE_EXIT { git_commit_free(parent); };
+                check_error(git_commit_tree(&parent_tree, parent));
+            }
+            SCOPE_EXIT { git_tree_free(parent_tree); };
+
+            if (path.empty()) {
+                changed = !parent_tree || !git_oid_equal(git_tree_id(tree), git_tree_id(parent_tree));
+            } else if (parent_tree) {
+                changed = !same_entry(tree, parent_tree, path);
+            } else {
+                // A root commit adds whatever it has.
+                git_tree_entry* entry = find_entry(tree, path);
+                changed = entry != nullptr;
+                git_tree_entry_free(entry);
+            }
+        }
+
+        if (changed) {
+            result.emplace_back(*current);
+        }
+        current = has_parent ? std::optional{parent_oid} : std::nullopt;
     }
-    check_error(err);
-    SCOPE_EXIT { git_blob_free(blob); };
 
-    const size_t size = git_blob_rawsize(blob);
-    std::string result;
-    result.resize(size);
-    std::memcpy(result.data(), git_blob_rawcontent(blob), size);
     return result;
 }
 
+std::shared_ptr<const ChangedPathFilters> Repository::changed_path_filters() const
+{
+    return ChangedPathFilters::load_shared(changed_path_filters_file(repo));
+}
+
+size_t Repository::write_changed_path_filters()
+{
+    const std::filesystem::path file = changed_path_filters_file(repo);
+    ChangedPathFilters result = ChangedPathFilters::load(file);
+
+    // Filters are always added for a whole first-parent chain, so a commit that has one is where the new ones start.
+    if (!get_head().commit) {
+        return 0;
+    }
+    const Oid head_commit = *get_head().commit;
+    std::optional<Oid> since;
+    for (Oid current = head_commit;;) {
+        if (result.contains(current)) {
+            since = current;
+            break;
+        }
+
+        git_commit* commit;
+        check_error(git_commit_lookup(&commit, repo, current));
+        SCOPE_EXIT { git_commit_free(commit); };
+
+        if (git_commit_parentcount(commit) == 0) {
+            break;
+        }
+        current = git_commit_parent_id(commit, 0);
+    }
+
+    size_t added = 0;
+    first_parent_changes(since, head_commit, [&](const Oid& commit, s64, const std::vector<PathChange>& changes) {
+        result.add(commit, changes);
+        ++added;
+    });
+
+    if (added != 0) {
+        std::filesystem::create_directories(file.parent_path());
+        result.save(file);
+    }
+    return added;
+}
+
+Repository::ObjectStats Repository::object_stats(std::chrono::seconds grace_period) const
+{
+    const std::filesystem::path objects_dir = std::filesystem::path{git_repository_commondir(repo)} / "objects";
+    const auto cutoff = std::filesystem::file_time_type::clock::now() - grace_period;
+    std::error_code ec;
+
+    ObjectStats result{};
+
+    // Only the packs, so that loose objects a repack has already packed but could not remove are not counted.
+    git_odb_backend* backend;
+    check_error(git_odb_backend_pack(&backend, objects_dir.c_str()));
+    git_odb* packs;
+    check_error(git_odb_new(&packs));
+    SCOPE_EXIT { git_odb_free(packs); };
+    check_error(git_odb_add_backend(packs, backend, 1));
+
+    // Like git gc --auto, estimate the number of loose objects from a single fan-out directory.
+    for (const auto& entry : std::filesystem::directory_iterator{objects_dir / "17", ec}) {
+        const auto id = loose_object_id("17", entry.path().filename().string());
+        if (entry.is_regular_file(ec) && id && !git_odb_exists(packs, *id)) {
+            result.loose_objects += 256;
+        }
+    }
+
+    // Packs a repack would keep anyway are not counted: .keep packs, and young ones, which include its own output
+    // and, with staged writes, the pack each commit writes.
+    for (const auto& entry : std::filesystem::directory_iterator{objects_dir / "pack", ec}) {
+        const auto& path = entry.path();
+        if (path.extension() == ".pack" && !std::filesystem::exists(std::filesystem::path{path}.replace_extension(".keep"), ec) && entry.last_write_time(ec) < cutoff && !ec) {
+            ++result.packs;
+        }
+    }
+
+    return result;
+}
+
+Repository::RepackResult Repository::repack(std::chrono::seconds grace_period)
+{
+    const std::filesystem::path objects_dir = std::filesystem::path{git_repository_commondir(repo)} / "objects";
+    // Anything written after this may not be reachable from the walk below, so it is never removed.
+    const auto cutoff = std::filesystem::file_time_type::clock::now() - grace_period;
+    std::error_code ec;
+
+    std::vector<std::filesystem::path> old_packs;
+    for (const auto& entry : std::filesystem::directory_iterator{objects_dir / "pack", ec}) {
+        const auto& path = entry.path();
+        if (path.extension() == ".pack" && !std::filesystem::exists(std::filesystem::path{path}.replace_extension(".keep"), ec)) {
+            old_packs.emplace_back(path);
+        }
+    }
+
+    git_odb* odb;
+    check_error(git_repository_odb(&odb, repo));
+    SCOPE_EXIT { git_odb_free(odb); };
+
+    git_revwalk* walk;
+    check_error(git_revwalk_new(&walk, repo));
+    SCOPE_EXIT { git_revwalk_free(walk); };
+
+    git_packbuilder* packbuilder;
+    check_error(git_packbuilder_new(&packbuilder, repo));
+    SCOPE_EXIT { git_packbuilder_free(packbuilder); };
+    // Searches for deltas on every core.
+    git_packbuilder_set_threads(packbuilder, 0);
+
+    // Adds `id` with everything it points at: a tag's target, a commit's tree and, by way of the walk, its history.
+    const auto keep = [&](const git_oid* id) {
+        // Reflogs name objects that have since been pruned, and the zero id where a ref was created or deleted.
+        if (git_odb_exists(odb, id)) {
+            check_error(git_packbuilder_insert_recur(packbuilder, id, nullptr));
+            push_commit(repo, walk, id);
+        }
+    };
+
+    // Keeps what git gc keeps: the target of every ref, whether a commit, an annotated tag, a tree or a blob, every
+    // object named in a reflog, which is where the stash keeps all but its newest entry, and the index.
+    for_each_ref(repo, [&](git_reference* ref) {
+        if (const auto target = ref_target(ref)) {
+            keep(*target);
+        }
+
+        git_reflog* reflog;
+        check_error(git_reflog_read(&reflog, repo, git_reference_name(ref)));
+        SCOPE_EXIT { git_reflog_free(reflog); };
+        for (size_t i = 0; i < git_reflog_entrycount(reflog); ++i) {
+            const git_reflog_entry* entry = git_reflog_entry_byindex(reflog, i);
+            keep(git_reflog_entry_id_old(entry));
+            keep(git_reflog_entry_id_new(entry));
+        }
+    });
+
+    git_index* index;
+    if (const int err = git_repository_index(&index, repo); err != GIT_EBAREREPO) {
+        check_error(err);
+        SCOPE_EXIT { git_index_free(index); };
+        for (size_t i = 0; i < git_index_entrycount(index); ++i) {
+            keep(&git_index_get_byindex(index, i)->id);
+        }
+    }
+
+    check_error(git_packbuilder_insert_walk(packbuilder, walk));
+    check_error(git_packbuilder_write(packbuilder, nullptr, 0, nullptr, nullptr));
+
+    RepackResult result{};
+    result.objects = git_packbuilder_object_count(packbuilder);
+
+    const std::filesystem::path new_pack = objects_dir / "pack" / fmt::format("pack-{}.pack", Oid{git_packbuilder_hash(packbuilder)}.to_string());
+    git_odb* packed = open_pack(std::filesystem::path{new_pack}.replace_extension(".idx"));
+    ASSERT_MSG(packed, "cannot read the pack just written");
+    SCOPE_EXIT { git_odb_free(packed); };
+
+    // Whatever the new pack holds can go regardless of age, as git prune-packed does, and so can packs it
+    // supersedes. Everything else left over is unreachable, and only removed once older than the grace period.
+    // Readers that still have an old pack mapped keep using it until they reload.
+    for (const auto& path : old_packs) {
+        if (path == new_pack) {
+            continue;
+        }
+        git_odb* pack = open_pack(std::filesystem::path{path}.replace_extension(".idx"));
+        SCOPE_EXIT { git_odb_free(pack); };
+        if (!contains_all(pack, packed) && (std::filesystem::last_write_time(path, ec) >= cutoff || ec)) {
+            continue;
+        }
+        for (const char* extension : {".idx", ".rev", ".pack"}) {
+            std::filesystem::remove(std::filesystem::path{path}.replace_extension(extension), ec);
+        }
+        ++result.removed_packs;
+    }
+
+    for_each_loose_object(objects_dir, [&](const std::filesystem::directory_entry& entry, const std::optional<Oid>& id) {
+        const bool superseded = id && git_odb_exists(packed, *id);
+        if ((superseded || (entry.last_write_time(ec) < cutoff && !ec)) && std::filesystem::remove(entry.path(), ec)) {
+            ++result.removed_loose_objects;
+        }
+    });
+
+    return result;
+}
+
+void Repository::write_commit_graph()
+{
+    const std::string info_dir = (std::filesystem::path{git_repository_commondir(repo)} / "objects" / "info").string();
+
+    git_revwalk* walk;
+    check_error(git_revwalk_new(&walk, repo));
+    SCOPE_EXIT { git_revwalk_free(walk); };
+    for_each_ref(repo, [&](git_reference* ref) {
+        if (const auto target = ref_target(ref)) {
+            push_commit(repo, walk, *target);
+        }
+    });
+
+    git_commit_graph_writer* writer;
+    check_error(git_commit_graph_writer_new(&writer, info_dir.c_str()));
+    SCOPE_EXIT { git_commit_graph_writer_free(writer); };
+    check_error(git_commit_graph_writer_add_revwalk(writer, walk));
+
+    git_commit_graph_writer_options options = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+    check_error(git_commit_graph_writer_commit(writer, &options));
+}
+
+void Repository::pack_refs()
+{
+    git_refdb* refdb;
+    check_error(git_repository_refdb(&refdb, repo));
+    SCOPE_EXIT { git_refdb_free(refdb); };
+
+    check_error(git_refdb_compress(refdb));
+}
+
+std::optional<BlobView> Repository::read(std::string path) const
+{
+    return snapshot().read(std::move(path));
+}
+
+BlobView Repository::read(const Oid& blob) const
+{
+    git_blob* result;
+    check_error(git_blob_lookup(&result, repo, blob));
+    return BlobView{std::shared_ptr<git_blob>{result, git_blob_free}};
+}
+
 }  // namespace libellus
@@ -1,16 +1,37 @@
+#pragma once
+
 #include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 
+#include <mcl/stdint.hpp>
+
+struct git_blob;
 struct git_commit;
+struct git_odb_backend;
 struct git_oid;
 struct git_repository;
 struct git_tree;
+struct git_writestream;
 
 namespace libellus {
 
+class ChangedPathFilters;
+
 struct Oid {
     Oid();
     /* implicit */ Oid(const git_oid* g);
@@ -19,34 +40,414 @@ struct Oid {
 
     operator const git_oid*() const { return (const git_oid*)oid.data(); }
     std::string to_string() const;
+
+    bool operator==(const Oid&) const = default;
 };
 
+/// Whether `path` can be written to: relative, and made of components that are neither empty, ".", ".." nor ".git".
+/// So no leading or trailing slash, and not the root directory.
+bool is_valid_path(std::string_view path);
+
+/// Makes every later object, pack and ref write by any Repository durable before it returns, at the cost of an
+/// fsync each. Must be called before the first Repository is opened.
+void enable_fsync();
+
 struct File {
     bool is_blob;
     std::string name;
     Oid oid;
 };
 
+/// The contents of a blob, read in place from the object database rather than copied out of it.
+/// Cheap to copy; the blob stays loaded for as long as any copy is alive. Like its Repository, it must
+/// only be used from one thread at a time.
+class BlobView {
+public:
+    std::span<const std::byte> bytes() const { return {data(), size()}; }
+    const std::byte* data() const;
+    size_t size() const;
+
+private:
+    friend class Repository;
+    friend class Snapshot;
+    explicit BlobView(std::shared_ptr<git_blob> blob);
+
+    std::shared_ptr<git_blob> blob;
+};
+
+/// The entries of a tree, read in place from the object database. Names point into the tree itself, so iterating
+/// allocates nothing. Cheap to copy; the tree stays loaded for as long as any copy, or any name taken from one,
+/// is in use. Like its Repository, it must only be used from one thread at a time.
+class TreeView {
+public:
+    struct Entry {
+        bool is_blob;
+        bool is_tree;  // Neither for submodules
+        std::string_view name;
+        Oid oid;
+    };
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Entry;
+
+        iterator() = default;
+
+        Entry operator*() const { return (*view)[index]; }
+        iterator& operator++()
+        {
+            ++index;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator result = *this;
+            ++index;
+            return result;
+        }
+
+        bool operator==(const iterator& other) const { return index == other.index; }
+
+    private:
+        friend class TreeView;
+        iterator(const TreeView* view, size_t index)
+            : view(view), index(index) {}
+
+        const TreeView* view = nullptr;
+        size_t index = 0;
+    };
+
+    const Oid& oid() const { return tree_oid; }
+    size_t size() const;
+    Entry operator[](size_t index) const;
+
+    iterator begin() const { return {this, 0}; }
+    iterator end() const { return {this, size()}; }
+
+private:
+    friend class Repository;
+    friend class Snapshot;
+    explicit TreeView(std::shared_ptr<git_tree> tree);
+
+    Oid tree_oid;
+    std::shared_ptr<git_tree> tree;
+};
+
+/// Every path in one commit's tree mapped to its entry, so that a path resolves with a single hash probe instead of
+/// a lookup in each tree from the root down. Built in full once, then carried from commit to commit by applying the
+/// diff between their trees.
+class PathIndex {
+public:
+    struct Entry {
+        Oid oid;
+        u32 filemode;
+
+        bool is_blob() const;
+        bool is_tree() const;
+    };
+
+    /// `path` has no leading or trailing slashes. The root directory is not indexed.
+    const Entry* find(std::string_view path) const;
+
+private:
+    friend class Repository;
+
+    /// Lets paths be looked up by string_view without building a std::string.
+    struct Hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view path) const { return std::hash<std::string_view>{}(path); }
+    };
+
+    static std::shared_ptr<PathIndex> build(git_repository* repo, const Oid& tree);
+    /// Turns this index of `old_tree` into an index of `new_tree`.
+    void update(git_repository* repo, const Oid& old_tree, const Oid& new_tree);
+
+    std::unordered_map<std::string, Entry, Hash, std::equal_to<>> entries;
+};
+
+/// An immutable view of the repository at a single commit, so that several lookups see the same tree.
+/// Cheap to copy. Like its Repository, it must only be used from one thread at a time.
+class Snapshot {
+public:
+    /// Nullopt while the ref is unborn, in which case the tree is the empty tree.
+    const std::optional<Oid>& commit() const { return commit_oid; }
+    const Oid& tree() const { return tree_oid; }
+
+    std::optional<TreeView> list(std::string path) const;
+    std::optional<File> stat(std::string path) const;
+    std::optional<BlobView> read(std::string path) const;
+
+private:
+    friend class Repository;
+    Snapshot(const std::optional<Oid>& commit, std::shared_ptr<git_tree> root, std::shared_ptr<const PathIndex> paths);
+
+    /// Looks `path`, without leading or trailing slashes, up in the index, if there is one. Returns nullopt without an
+    /// index.
+    std::optional<const PathIndex::Entry*> find_indexed(std::string_view path) const;
+
+    std::optional<Oid> commit_oid;
+    Oid tree_oid;
+    std::shared_ptr<git_tree> root;
+    std::shared_ptr<const PathIndex> paths;
+};
+
+/// Writes a blob piece by piece, so that its contents never have to be in memory all at once.
+/// Discarded unless finished with finish().
+class BlobWriter {
+public:
+    BlobWriter(BlobWriter&& other);
+    BlobWriter& operator=(BlobWriter&& other);
+    ~BlobWriter();
+
+    void write(std::string_view data);
+    /// Adds the blob to the object database and returns its Oid.
+    Oid finish() &&;
+
+private:
+    friend class Repository;
+    explicit BlobWriter(git_writestream* stream);
+
+    git_writestream* stream;
+};
+
+/// Why a transaction was not committed.
+struct CommitError {
+    enum class Kind {
+        /// Another writer changed a path the transaction touches first.
+        Conflict,
+        /// The transaction does not apply to the tree it was committed onto, such as a rename whose source does
+        /// not exist. Trying again will not help.
+        Invalid,
+    };
+
+    Kind kind;
+    std::string message;
+};
+
+/// The commit a transaction made, or why it made none.
+class CommitResult {
+public:
+    /// Only so that a coroutine has something to receive the result into.
+    CommitResult()
+        : result(CommitError{CommitError::Kind::Invalid, "not committed"}) {}
+    /* implicit */ CommitResult(const Oid& commit)
+        : result(commit) {}
+    /* implicit */ CommitResult(CommitError error)
+        : result(std::move(error)) {}
+
+    explicit operator bool() const { return std::holds_alternative<Oid>(result); }
+    const Oid& operator*() const { return std::get<Oid>(result); }
+    const Oid* operator->() const { return &std::get<Oid>(result); }
+
+    /// Only valid without a commit.
+    const CommitError& error() const { return std::get<CommitError>(result); }
+
+private:
+    std::variant<Oid, CommitError> result;
+};
+
+/// A set of changes to apply to the tree in a single commit. Later changes to a path replace earlier ones.
+/// Blobs are written as soon as they are added; the tree and commit only when the transaction is committed.
+/// A change that cannot be staged makes committing the transaction fail with CommitError::Kind::Invalid.
+class Transaction {
+public:
+    void upsert(std::string path, std::string_view contents);
+    /// Points `path` at a blob that already exists in the object database.
+    void upsert(std::string path, const Oid& blob, bool executable = false);
+    void remove(std::string path);
+    /// Moves a file or directory, as it is in this transaction or else in the tree being committed onto. Changes
+    /// already staged under `from` move with it, and whatever was staged under `to` is replaced.
+    void rename(std::string from, std::string to);
+
+    /// Whether committing would change nothing. A transaction with a change that failed is not empty.
+    bool empty() const { return changes.empty() && failure.empty(); }
+
+private:
+    friend class Repository;
+    explicit Transaction(git_repository* repo);
+
+    /// Whether every path this transaction reads or writes is the same in both trees, and every directory above
+    /// one is still a directory.
+    bool unaffected_between(git_repository* repo, const Oid& before, const Oid& after) const;
+    /// Whether a change is staged at a path under `dir`.
+    bool has_changes_under(const std::string& dir) const;
+    void discard_changes_under(const std::string& dir);
+    /// Keeps the first failure only, as later ones may just follow from it.
+    void fail(std::string message);
+
+    enum class Action {
+        Upsert,
+        Remove,
+        CopyFromBase,
+    };
+
+    struct Change {
+        Action action;
+        Oid oid;
+        u32 filemode;
+        std::string source;  // For CopyFromBase
+    };
+
+    git_repository* repo;
+    std::map<std::string, Change> changes;
+    std::string failure;  // Why the first change that failed did, if any did
+};
+
 class Repository {
 public:
-    Repository(const std::string& repo_path, std::string_view refname = "refs/heads/master");
+    /// With `stage_writes`, new objects are kept in memory and written out as a single packfile just before
+    /// each commit moves the ref, instead of as one loose file per object. Attempts that lose the race for the ref
+    /// write nothing; their objects go out with the next attempt's pack.
+    /// With `index_paths`, every path of the current commit is kept in a PathIndex for lookups.
+    /// `refname` may be unborn, in which case the first commit creates it; until then it reads as an empty tree.
+    Repository(const std::string& repo_path, std::string_view refname = "refs/heads/master", bool stage_writes = false, bool index_paths = false);
     ~Repository();
 
-    std::optional<std::vector<File>> list(std::string path) const;
+    Repository(const Repository&) = delete;
+    Repository& operator=(const Repository&) = delete;
+
+    /// Resolves the ref once and pins the resulting commit.
+    Snapshot snapshot() const;
+
+    std::optional<TreeView> list(std::string path) const;
+    /// Lists the tree with the given Oid, independently of the current commit.
+    TreeView list(const Oid& tree) const;
+
+    /// Looks up a single path without listing or reading it. The root directory has an empty name.
+    std::optional<File> stat(std::string path) const;
+
+    CommitResult commit(const std::string& commit_message, std::string path, std::string_view contents);
+
+    /// Starts writing a new blob, for example as an upload arrives, to be committed later by its Oid.
+    BlobWriter write_blob();
+    /// Writes a blob whose contents are already in memory, to be committed later by its Oid.
+    Oid write_blob(std::string_view contents);
+    /// Writes every object staged in memory so far to disk as one pack. Does nothing unless staging writes.
+    void flush_staged_objects();
+
+    /// Starts collecting changes to be committed together with commit(message, transaction).
+    Transaction transaction();
+    /// Applies every change in `transaction` with one tree update and records them in one commit.
+    /// The ref is only moved if it still points at the parent; if another writer moved it first, the changes
+    /// are replayed onto its commit as long as it did not touch the same paths.
+    CommitResult commit(const std::string& commit_message, const Transaction& transaction);
+
+    std::optional<BlobView> read(std::string path) const;
+    /// Reads the blob with the given Oid, independently of the current commit.
+    BlobView read(const Oid& blob) const;
+
+    /// What a history page shows of a commit.
+    struct CommitInfo {
+        Oid oid;
+        std::vector<Oid> parents;
+        s64 author_time;  // In seconds since the epoch
+        std::string author;  // "Name <email>"
+        std::string summary;  // The first paragraph of the message, on one line
+    };
+
+    CommitInfo commit_info(const Oid& commit) const;
 
-    void commit(const std::string& commit_message, std::string path, std::string_view contents);
+    /// Calls `visit` for each commit after `since` up to and including `until` along first parents, oldest first.
+    /// Without `since`, starts from the root commit. Returns false without calling `visit` if `since` is not a
+    /// first-parent ancestor of `until`.
+    bool first_parent_commits(const std::optional<Oid>& since, const Oid& until, const std::function<void(const CommitInfo& commit)>& visit) const;
 
-    std::optional<std::string> read(std::string path) const;
+    /// A path added, modified or deleted by a commit, relative to its first parent.
+    struct PathChange {
+        std::string path;
+        bool deleted;
+    };
+
+    /// Calls `visit` for each commit after `since` up to and including `until` along first parents, oldest first,
+    /// with the commit time and the files it changed. Without `since`, starts from the root commit. Returns false
+    /// without calling `visit` if `since` is not a first-parent ancestor of `until`.
+    bool first_parent_changes(const std::optional<Oid>& since, const Oid& until, const std::function<void(const Oid& commit, s64 time, const std::vector<PathChange>& changes)>& visit) const;
+
+    /// The commits that changed `path`, a file or directory, along first parents from the current commit, newest
+    /// first and at most `limit` of them. Commits ruled out by their changed-path filter are skipped without
+    /// reading their trees; commits newer than the filters are compared in full.
+    std::vector<Oid> history(std::string path, size_t limit = SIZE_MAX) const;
+
+    struct ObjectStats {
+        /// Estimated from a sample, as git gc --auto does. Objects that are also in a pack are not counted.
+        size_t loose_objects;
+        /// Packs older than the grace period and without a .keep file; a repack leaves the others alone.
+        size_t packs;
+    };
+
+    struct RepackResult {
+        size_t objects;
+        size_t removed_packs;
+        size_t removed_loose_objects;
+    };
+
+    /// What a repack with `grace_period` would clean up.
+    ObjectStats object_stats(std::chrono::seconds grace_period) const;
+    /// Packs every object git gc would keep, those reachable from a ref, a reflog entry or the index, into one new
+    /// pack. Loose objects and packs (other than .keep ones) whose objects are all in the new pack are then removed,
+    /// and so are the rest, which are unreachable, once older than `grace_period`.
+    RepackResult repack(std::chrono::seconds grace_period);
+    /// Writes objects/info/commit-graph for every commit reachable from a ref.
+    void write_commit_graph();
+    /// Adds changed-path filters for first-parent commits of the ref that do not have one yet, and returns how many.
+    size_t write_changed_path_filters();
+    /// Moves loose refs into packed-refs.
+    void pack_refs();
 
 private:
-    void check_error(int err) const;
+    /// The on-disk state of the files backing a ref: the contents of each loose ref in its
+    /// symbolic chain (nullopt if packed or unborn), and the modification time and size of packed-refs.
+    struct RefState {
+        std::vector<std::optional<std::string>> loose_refs;
+        std::optional<std::pair<std::filesystem::file_time_type, std::uintmax_t>> packed_refs;
+
+        bool operator==(const RefState&) const = default;
+    };
 
-    std::string get_full_reference_name() const;
-    git_commit* get_current_commit() const;
-    git_tree* get_current_tree() const;
+    struct Head {
+        std::optional<Oid> commit;  // Nullopt while the ref is unborn
+        Oid tree;                   // The empty tree while the ref is unborn
+        std::vector<std::string> ref_chain;
+        RefState ref_state;
+    };
+
+    RefState read_ref_state(const std::vector<std::string>& ref_chain) const;
+    const Head& get_head() const;
+    /// The commits after `since` up to and including `until` along first parents, oldest first; nullopt if `since`
+    /// is not a first-parent ancestor of `until`. Without `since`, starts from the root commit.
+    std::optional<std::vector<Oid>> first_parent_chain(const std::optional<Oid>& since, const Oid& until) const;
+    /// The index of `tree`, updated from the last one built. Null unless indexing paths.
+    std::shared_ptr<const PathIndex> index_for(const Oid& tree) const;
+    /// The filters last written by write_changed_path_filters(), shared by every handle onto the repository.
+    std::shared_ptr<const ChangedPathFilters> changed_path_filters() const;
+
+    /// Moves the ref to `commit` if it still points at `expected`, or is still unborn without one, writing out staged
+    /// objects just before. Returns false, having written nothing, if another writer has moved it or is moving it.
+    bool update_ref(const Oid& commit, const std::optional<Oid>& expected, const std::string& reflog_message);
+    /// Writes the tree and commit for `transaction` on top of `parent`, or as a root commit without one, without
+    /// touching any ref. Returns the commit and tree, or why the transaction does not apply to `parent`.
+    std::variant<std::pair<Oid, Oid>, CommitError> create_commit(const std::string& commit_message, const Transaction& transaction, const std::optional<Oid>& parent);
+
+    /// Gives up on a commit after this many other writers have moved the ref underneath it.
+    static constexpr size_t max_commit_attempts = 8;
 
     git_repository* repo = nullptr;
+    /// Owned by the repository's odb once added to it.
+    git_odb_backend* mempack = nullptr;
     std::string refname;
+    std::string full_refname;
+    bool index_paths;
+
+    /// Resolved lazily and reused for as long as the ref files are unchanged.
+    mutable std::optional<Head> head;
+
+    /// The most recent index, of `paths_tree`. Changed in place when no snapshot still uses it.
+    mutable std::shared_ptr<PathIndex> paths;
+    mutable Oid paths_tree;
 };
 
 }  // namespace libellus
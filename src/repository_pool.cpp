@@ -0,0 +1,12 @@
+#include "repository_pool.hpp"
+
+namespace libellus {
+
+RepositoryPool::RepositoryPool(const std::string& repo_path, std::string_view refname, size_t size, bool index_paths)
+{
+    for (size_t i = 0; i < size; ++i) {
+        repositories.emplace_back(std::make_unique<Repository>(repo_path, refname, false, index_paths));
+    }
+}
+
+}  // namespace libellus
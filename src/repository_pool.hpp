@@ -0,0 +1,28 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mcl/stdint.hpp>
+
+#include "repository.hpp"
+
+namespace libellus {
+
+/// A fixed set of handles onto the same repository, opened once at startup.
+/// Handles are not thread-safe: each is intended to be owned by a single worker thread,
+/// and is shared by every session on that thread so its object cache stays warm.
+class RepositoryPool {
+public:
+    RepositoryPool(const std::string& repo_path, std::string_view refname, size_t size, bool index_paths = false);
+
+    size_t size() const { return repositories.size(); }
+    Repository& operator[](size_t index) { return *repositories[index]; }
+
+private:
+    std::vector<std::unique_ptr<Repository>> repositories;
+};
+
+}  // namespace libellus
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+
+namespace libellus {
+
+/// A Beast body that shares ownership of an immutable buffer (anything with data() and size()),
+/// so that cached content can be sent without being copied into the response.
+/// Only serialization is supported.
+template<typename T>
+struct SharedBody {
+    using value_type = std::shared_ptr<const T>;
+
+    static std::uint64_t size(const value_type& body)
+    {
+        return body->size();
+    }
+
+    class writer {
+    public:
+        using const_buffers_type = boost::asio::const_buffer;
+
+        template<bool isRequest, typename Fields>
+        explicit writer(const boost::beast::http::header<isRequest, Fields>&, const value_type& body)
+            : body(body) {}
+
+        void init(boost::beast::error_code& ec)
+        {
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>> get(boost::beast::error_code& ec)
+        {
+            ec = {};
+            return {{const_buffers_type{body->data(), body->size()}, false}};
+        }
+
+    private:
+        const value_type& body;
+    };
+};
+
+}  // namespace libellus
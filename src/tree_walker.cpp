@@ -0,0 +1,116 @@
+#include "tree_walker.hpp"
+
+#include <utility>
+
+#include <fmt/format.h>
+#include <mcl/assert.hpp>
+
+namespace libellus {
+
+TreeWalker::TreeWalker(const std::string& repo_path, std::string_view refname, size_t threads)
+    : work(boost::asio::make_work_guard(ioc))
+{
+    ASSERT(threads > 0);
+
+    for (size_t i = 0; i < threads; ++i) {
+        repositories.emplace_back(std::make_unique<Repository>(repo_path, refname));
+    }
+
+    // The calling thread of a walk lists with the first handle, so each of the others gets a helper.
+    for (size_t i = 1; i < threads; ++i) {
+        helpers.emplace_back([this, &repo = *repositories[i]] { help(repo); });
+    }
+    thread = std::thread{[this] { ioc.run(); }};
+}
+
+TreeWalker::~TreeWalker()
+{
+    work.reset();
+    thread.join();
+
+    {
+        std::lock_guard lock{mutex};
+        stopping = true;
+    }
+    changed.notify_all();
+    for (auto& helper : helpers) {
+        helper.join();
+    }
+}
+
+bool TreeWalker::walk(std::string path, const Visitor& visitor)
+{
+    std::lock_guard lock{walk_mutex};
+
+    const auto dir = repositories[0]->list(path);
+    if (!dir) {
+        return false;
+    }
+
+    path.erase(0, path.find_first_not_of('/'));
+    path.erase(path.find_last_not_of('/') + 1);
+    walk_tree(dir->oid(), std::move(path), visitor);
+    return true;
+}
+
+void TreeWalker::walk(const Oid& tree, const Visitor& visitor)
+{
+    std::lock_guard lock{walk_mutex};
+    walk_tree(tree, "", visitor);
+}
+
+void TreeWalker::walk_tree(const Oid& tree, std::string prefix, const Visitor& visitor)
+{
+    std::unique_lock lock{mutex};
+    this->visitor = &visitor;
+    queue.emplace_back(tree, std::move(prefix));
+    changed.notify_all();
+
+    // Done once nothing is queued and nobody is listing a tree that may yet queue more.
+    for (;;) {
+        changed.wait(lock, [&] { return !queue.empty() || busy == 0; });
+        if (queue.empty()) {
+            break;
+        }
+        list_next(*repositories[0], lock);
+    }
+    this->visitor = nullptr;
+}
+
+void TreeWalker::help(Repository& repo)
+{
+    std::unique_lock lock{mutex};
+    for (;;) {
+        changed.wait(lock, [&] { return !queue.empty() || stopping; });
+        if (stopping) {
+            return;
+        }
+        list_next(repo, lock);
+    }
+}
+
+void TreeWalker::list_next(Repository& repo, std::unique_lock<std::mutex>& lock)
+{
+    const auto [oid, dir] = std::move(queue.front());
+    queue.pop_front();
+    ++busy;
+    lock.unlock();
+
+    std::vector<std::pair<Oid, std::string>> subtrees;
+    for (const auto& entry : repo.list(oid)) {
+        std::string path = dir.empty() ? std::string{entry.name} : fmt::format("{}/{}", dir, entry.name);
+        (*visitor)(path, entry);
+        if (entry.is_tree) {
+            subtrees.emplace_back(entry.oid, std::move(path));
+        }
+    }
+
+    lock.lock();
+    --busy;
+    for (auto& subtree : subtrees) {
+        queue.emplace_back(std::move(subtree));
+    }
+    changed.notify_all();
+}
+
+}  // namespace libellus
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <mcl/stdint.hpp>
+
+#include "repository.hpp"
+
+namespace libellus {
+
+/// Visits every entry under a tree, for things like search indexing, exports and size totals that need all of it.
+/// Subtrees are independent, so they are shared out between threads that each list them through a handle of their
+/// own. The threads and their handles are started once and kept, so their object caches stay warm between walks and a
+/// walk costs no thread start-up. One walk runs at a time.
+class TreeWalker {
+public:
+    /// Called with the full path of each entry. Called from several threads at once, in no particular order.
+    using Visitor = std::function<void(std::string_view path, const TreeView::Entry& entry)>;
+
+    TreeWalker(const std::string& repo_path, std::string_view refname, size_t threads);
+    ~TreeWalker();
+
+    TreeWalker(const TreeWalker&) = delete;
+    TreeWalker& operator=(const TreeWalker&) = delete;
+
+    /// Visits everything under `path` in the current commit. Returns false if `path` is not a directory.
+    bool walk(std::string path, const Visitor& visitor);
+    /// Visits everything under the tree with the given Oid, with paths relative to it.
+    void walk(const Oid& tree, const Visitor& visitor);
+
+    /// Like walk(), but run by the walker's own thread so that the caller can get on with other work meanwhile.
+    /// Completes with walk()'s result on the executor associated with the handler; `visitor` must outlive the walk.
+    template<typename CompletionToken>
+    auto async_walk(std::string path, const Visitor& visitor, CompletionToken&& token)
+    {
+        return boost::asio::async_initiate<CompletionToken, void(bool)>(
+            [this, &visitor](auto handler, std::string path) {
+                auto work = boost::asio::make_work_guard(handler);
+                auto shared_handler = std::make_shared<decltype(handler)>(std::move(handler));
+                boost::asio::post(ioc, [this, &visitor, shared_handler, work, path = std::move(path)]() mutable {
+                    const bool found = walk(std::move(path), visitor);
+                    boost::asio::post(work.get_executor(), [shared_handler, found] { (*shared_handler)(found); });
+                    work.reset();
+                });
+            },
+            token, std::move(path));
+    }
+
+private:
+    void walk_tree(const Oid& tree, std::string prefix, const Visitor& visitor);
+    /// Run by each helper thread, with its own handle, for as long as the walker lives.
+    void help(Repository& repo);
+    /// Lists the tree at the front of the queue and queues its subtrees. Called and returns with `lock` held.
+    void list_next(Repository& repo, std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::unique_ptr<Repository>> repositories;
+    std::mutex walk_mutex;
+
+    // The walk in progress, shared with the helpers.
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::pair<Oid, std::string>> queue;
+    size_t busy = 0;  // Threads listing a tree, which may yet queue more
+    const Visitor* visitor = nullptr;
+    bool stopping = false;
+    std::vector<std::thread> helpers;
+
+    boost::asio::io_context ioc{1};
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    std::thread thread;
+};
+
+}  // namespace libellus
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "repository.hpp"
+
+namespace libellus {
+
+/// A change to a single path, held by value so that it can be handed to the thread that commits it.
+struct Change {
+    enum class Kind {
+        Upsert,
+        Remove,
+        Rename,
+        /// Points the path at a blob that has already been written, such as a streamed upload.
+        UpsertBlob,
+    };
+
+    Kind kind;
+    std::string path;
+    std::string data;  // New contents for Upsert, destination path for Rename
+    Oid blob = {};     // For UpsertBlob
+};
+
+/// The changes made by one request, and the message describing them.
+struct WriteRequest {
+    std::string message;
+    std::vector<Change> changes;
+};
+
+}  // namespace libellus